@@ -1,89 +1,158 @@
 unsigned char MainLoader_chip_bin[] = {
-  0x00, 0x18, 0x06, 0xf6, 0x01, 0x02, 0xce, 0xf7, 0x14, 0x00, 0x90, 0xad,
+  0xa9, 0x22, 0x29, 0xff, 0x49, 0xf1, 0x0f, 0xf2, 0xc4, 0x06, 0x90, 0xad,
+  0x00, 0xba, 0x07, 0xf6, 0x01, 0xa4, 0xcf, 0xf7, 0x14, 0x00, 0x90, 0xad,
   0x3d, 0x00, 0x00, 0xff, 0xff, 0xef, 0x07, 0xf6, 0x00, 0xf2, 0x07, 0xf6,
   0x28, 0xee, 0x63, 0xfd, 0x80, 0x01, 0x6c, 0xfc, 0x40, 0x7e, 0x64, 0xfd,
-  0x40, 0x7c, 0x64, 0xfd, 0x90, 0x02, 0xb0, 0xfd, 0xbf, 0xec, 0x03, 0xf6,
+  0x40, 0x7c, 0x64, 0xfd, 0x20, 0x06, 0xb0, 0xfd, 0xcc, 0xed, 0x03, 0xf6,
   0x0d, 0xec, 0x67, 0xf0, 0x07, 0xec, 0x47, 0xf5, 0x00, 0x00, 0x80, 0xff,
   0x3e, 0xf8, 0x0c, 0xfc, 0x3e, 0xec, 0x17, 0xfc, 0x41, 0x7c, 0x64, 0xfd,
   0x00, 0x00, 0x80, 0xff, 0x3f, 0x7c, 0x0c, 0xfc, 0x3f, 0xec, 0x17, 0xfc,
   0x41, 0x7e, 0x64, 0xfd, 0x40, 0x7e, 0x74, 0xfd, 0xf8, 0xff, 0x9f, 0x3d,
-  0x3f, 0x0a, 0x8e, 0xfa, 0x18, 0x0a, 0x46, 0xf0, 0x80, 0x0a, 0x0e, 0xf2,
-  0xb0, 0xff, 0x9f, 0x5d, 0x00, 0x10, 0x06, 0xf6, 0xc8, 0x01, 0xb0, 0xfd,
-  0x04, 0x02, 0xb0, 0xfd, 0x3d, 0x0a, 0x0e, 0xf2, 0x34, 0x00, 0x90, 0xad,
-  0x21, 0x0a, 0x0e, 0xf2, 0x80, 0x00, 0x90, 0xad, 0x46, 0x0a, 0x0e, 0xf2,
-  0xfc, 0x00, 0x90, 0xad, 0x2d, 0x0a, 0x0e, 0xf2, 0x80, 0x00, 0x90, 0xad,
+  0x3f, 0xac, 0x8f, 0xfa, 0x18, 0xac, 0x47, 0xf0, 0x80, 0xac, 0x0f, 0xf2,
+  0xb0, 0xff, 0x9f, 0x5d, 0x00, 0xb2, 0x07, 0xf6, 0x58, 0x05, 0xb0, 0xfd,
+  0x94, 0x05, 0xb0, 0xfd, 0xfe, 0xad, 0x97, 0xfb, 0x80, 0xac, 0x0f, 0xf2,
+  0xf0, 0xff, 0x9f, 0xad, 0x3d, 0xac, 0x0f, 0xf2, 0x64, 0x00, 0x90, 0xad,
+  0x21, 0xac, 0x0f, 0xf2, 0xa4, 0x01, 0x90, 0xad, 0x46, 0xac, 0x0f, 0xf2,
+  0x78, 0x02, 0x90, 0xad, 0x2d, 0xac, 0x0f, 0xf2, 0xe8, 0x01, 0x90, 0xad,
+  0x42, 0xac, 0x0f, 0xf2, 0x9c, 0x01, 0x90, 0xad, 0x57, 0xac, 0x0f, 0xf2,
+  0x4c, 0x03, 0x90, 0xad, 0x43, 0xac, 0x0f, 0xf2, 0x7c, 0x03, 0x90, 0xad,
+  0x5a, 0xac, 0x0f, 0xf2, 0xa0, 0x00, 0x90, 0xad, 0x48, 0xac, 0x0f, 0xf2,
+  0xd0, 0x00, 0x90, 0xad, 0x45, 0xac, 0x0f, 0xf2, 0x70, 0x00, 0x90, 0xad,
   0x59, 0x70, 0x64, 0xfd, 0x58, 0x72, 0x64, 0xfd, 0x4b, 0x4c, 0x80, 0xff,
   0x1f, 0x00, 0x65, 0xfd, 0x5f, 0x70, 0x64, 0xfd, 0x5f, 0x72, 0x64, 0xfd,
-  0xec, 0xff, 0x9f, 0xfd, 0x00, 0x10, 0x06, 0xf6, 0xd0, 0x01, 0xb0, 0xfd,
-  0x06, 0x05, 0x02, 0xf6, 0xff, 0xff, 0x7f, 0xff, 0xff, 0x7d, 0x0d, 0xf2,
-  0x02, 0x7d, 0x01, 0xa6, 0xbc, 0x01, 0xb0, 0xfd, 0x06, 0x07, 0x02, 0xf6,
-  0x1f, 0x04, 0x16, 0xf4, 0xd0, 0x00, 0x90, 0xcd, 0x73, 0x0e, 0x06, 0xf6,
-  0x84, 0x01, 0xb0, 0xfd, 0x02, 0x01, 0x88, 0xfc, 0x00, 0x00, 0x00, 0x00,
-  0x8c, 0x01, 0xb0, 0xfd, 0x15, 0x0a, 0x62, 0xfd, 0x05, 0x11, 0x02, 0xf1,
-  0xfc, 0x07, 0x6e, 0xfb, 0x00, 0x00, 0x7c, 0xfc, 0x38, 0x01, 0xb0, 0xfd,
-  0x6c, 0xff, 0x9f, 0xfd, 0x2d, 0x7c, 0x61, 0xfd, 0xf8, 0x19, 0x02, 0xf6,
-  0x01, 0x7c, 0x65, 0xf6, 0x5c, 0xff, 0x9f, 0xfd, 0x09, 0x3d, 0x80, 0xff,
-  0x1f, 0x00, 0x64, 0xfd, 0x02, 0x18, 0x96, 0xfb, 0x01, 0x1e, 0x66, 0xf6,
-  0x48, 0x00, 0xb0, 0xfd, 0x40, 0x7c, 0x64, 0xfd, 0x40, 0x7e, 0x64, 0xfd,
-  0x3e, 0x00, 0x0c, 0xfc, 0x3f, 0x00, 0x0c, 0xfc, 0x02, 0x02, 0xce, 0xf7,
-  0x24, 0x00, 0x90, 0xad, 0x00, 0xed, 0x0b, 0xf6, 0x1c, 0x00, 0x90, 0xad,
-  0x00, 0xed, 0x23, 0xf5, 0x00, 0xec, 0x63, 0xfd, 0xe8, 0x01, 0x80, 0xff,
-  0x1f, 0x20, 0x65, 0xfd, 0x03, 0x00, 0xce, 0xf7, 0x03, 0x00, 0x46, 0xa5,
-  0x00, 0x00, 0x62, 0xfd, 0x12, 0x13, 0x80, 0xff, 0x1f, 0x40, 0x67, 0xfd,
-  0xbe, 0x00, 0xe8, 0xfc, 0x0c, 0x27, 0x1a, 0xfb, 0xf8, 0xff, 0x9f, 0xcd,
-  0xa0, 0x00, 0x90, 0x5d, 0x28, 0x06, 0x64, 0xfd, 0x0c, 0x1f, 0x62, 0xfc,
-  0x2d, 0x00, 0x64, 0xfd, 0xfc, 0x00, 0xb0, 0xfd, 0x00, 0x00, 0x78, 0xff,
-  0x00, 0x1e, 0x06, 0xf6, 0x02, 0x00, 0x40, 0xff, 0x00, 0x20, 0x06, 0xf6,
-  0x06, 0x23, 0x02, 0xf6, 0xcc, 0xff, 0xbf, 0xfd, 0x6c, 0xff, 0x9f, 0xfd,
-  0x19, 0x18, 0x96, 0xfb, 0xfe, 0x03, 0x78, 0xff, 0x00, 0x1a, 0x06, 0xf6,
-  0xc0, 0x1a, 0x62, 0xf5, 0xc0, 0x1c, 0x02, 0xf6, 0xc0, 0x06, 0x1a, 0xf2,
-  0x03, 0x1d, 0x02, 0xc6, 0x0d, 0x1f, 0x02, 0xf6, 0x02, 0x21, 0x02, 0xf6,
-  0x0e, 0x23, 0x02, 0xf6, 0x6b, 0x0e, 0x06, 0xf6, 0x8c, 0x00, 0xb0, 0xfd,
-  0x0d, 0xf3, 0x03, 0xf6, 0x0e, 0xef, 0x03, 0xf6, 0x94, 0x00, 0xb0, 0xfd,
-  0xe1, 0x0b, 0x46, 0xfc, 0x05, 0x11, 0x02, 0xf1, 0xfc, 0xef, 0x6f, 0xfb,
-  0x7c, 0xff, 0xbf, 0xfd, 0x0e, 0x05, 0x02, 0xf1, 0x0e, 0x07, 0x9a, 0xf1,
-  0xb4, 0xff, 0x9f, 0x5d, 0x0c, 0x27, 0x1a, 0xfb, 0xf8, 0xff, 0x9f, 0xcd,
-  0x10, 0x00, 0x90, 0x5d, 0xec, 0xfe, 0x9f, 0xfd, 0x68, 0x0e, 0x06, 0xf6,
-  0x4c, 0x00, 0xb0, 0xfd, 0x94, 0xfe, 0x9f, 0xfd, 0x65, 0x0e, 0x06, 0xf6,
-  0x40, 0x00, 0xb0, 0xfd, 0x13, 0xf3, 0x03, 0xf6, 0xe1, 0x0f, 0xce, 0xfa,
-  0x80, 0xfe, 0x9f, 0xad, 0x30, 0x00, 0xb0, 0xfd, 0xf0, 0xff, 0x9f, 0xfd,
-  0x08, 0x0f, 0x02, 0xf6, 0x04, 0x0e, 0x46, 0xf0, 0x0f, 0x0e, 0x06, 0xf5,
-  0x40, 0x0e, 0x06, 0xf1, 0x18, 0x00, 0xb0, 0xfd, 0x08, 0x0f, 0x02, 0xf6,
-  0x0f, 0x0e, 0x06, 0xf5, 0x40, 0x0e, 0x06, 0xf1, 0x08, 0x00, 0xb0, 0xfd,
-  0x20, 0x0e, 0x06, 0xf6, 0x00, 0x00, 0x90, 0xfd, 0x3e, 0x0e, 0x26, 0xfc,
+  0xec, 0xff, 0x9f, 0xfd, 0x00, 0xb2, 0x07, 0xf6, 0x24, 0x05, 0xb0, 0xfd,
+  0xd7, 0xa7, 0x03, 0xf6, 0xff, 0xff, 0x7f, 0xff, 0xff, 0x97, 0x0f, 0xf2,
+  0xd3, 0x97, 0x03, 0xa6, 0x10, 0x05, 0xb0, 0xfd, 0xd7, 0xa9, 0x03, 0xf6,
+  0x1f, 0xa6, 0x17, 0xf4, 0x1c, 0x02, 0x90, 0xcd, 0x73, 0xb0, 0x07, 0xf6,
+  0xd8, 0x04, 0xb0, 0xfd, 0xd3, 0x01, 0x88, 0xfc, 0x00, 0x00, 0x00, 0x00,
+  0xe0, 0x04, 0xb0, 0xfd, 0x15, 0xac, 0x63, 0xfd, 0xd6, 0xb3, 0x03, 0xf1,
+  0xfc, 0xa9, 0x6f, 0xfb, 0x00, 0x00, 0x7c, 0xfc, 0x8c, 0x04, 0xb0, 0xfd,
+  0x30, 0xff, 0x9f, 0xfd, 0x00, 0xb2, 0x07, 0xf6, 0xd0, 0x04, 0xb0, 0xfd,
+  0xd7, 0xab, 0x0b, 0xf6, 0xe8, 0xff, 0x9f, 0xad, 0xb4, 0x04, 0xb0, 0xfd,
+  0xd6, 0xb3, 0x03, 0xf1, 0xfd, 0xab, 0x6f, 0xfb, 0xd8, 0xff, 0x9f, 0xfd,
+  0x00, 0xb2, 0x07, 0xf6, 0xb0, 0x04, 0xb0, 0xfd, 0xd7, 0xa7, 0x03, 0xf6,
+  0xff, 0xff, 0x7f, 0xff, 0xff, 0x97, 0x0f, 0xf2, 0xd3, 0x97, 0x03, 0xa6,
+  0x9c, 0x04, 0xb0, 0xfd, 0xee, 0xaf, 0x97, 0xfb, 0xd3, 0x01, 0x88, 0xfc,
+  0x00, 0x00, 0x00, 0x00, 0xd7, 0x03, 0xd8, 0xfc, 0x15, 0x00, 0x64, 0xfd,
+  0x00, 0x00, 0x7c, 0xfc, 0xa0, 0xff, 0x9f, 0xfd, 0x7c, 0x04, 0xb0, 0xfd,
+  0xd7, 0xa7, 0x03, 0xf6, 0xff, 0xff, 0x7f, 0xff, 0xff, 0x97, 0x0f, 0xf2,
+  0xd3, 0x97, 0x03, 0xa6, 0x68, 0x04, 0xb0, 0xfd, 0xd7, 0xa9, 0x03, 0xf6,
+  0x60, 0x04, 0xb0, 0xfd, 0xd7, 0xab, 0x03, 0xf6, 0xd3, 0x01, 0x78, 0xfc,
+  0xab, 0xa9, 0x97, 0xfb, 0xd5, 0xd7, 0x03, 0xf6, 0xd4, 0xd7, 0x23, 0xf3,
+  0xeb, 0xa9, 0x83, 0xf1, 0x01, 0xb2, 0x67, 0xf6, 0xeb, 0xd9, 0x03, 0xf6,
+  0x03, 0xd8, 0x07, 0xf5, 0x02, 0xd6, 0x4f, 0xf0, 0x18, 0x00, 0x90, 0xad,
+  0x12, 0xce, 0x63, 0xfd, 0x69, 0xce, 0x63, 0xfd, 0x28, 0xce, 0x63, 0xfd,
+  0x08, 0x02, 0xdc, 0xfc, 0xd0, 0xb3, 0xdb, 0xf9, 0xfa, 0xd7, 0x6f, 0xfb,
+  0x06, 0xd8, 0x97, 0xfb, 0x10, 0xce, 0x63, 0xfd, 0x69, 0xce, 0x63, 0xfd,
+  0x28, 0xce, 0x63, 0xfd, 0xd0, 0xb3, 0xdb, 0xf9, 0xd0, 0xb3, 0xdb, 0xf9,
+  0xf9, 0xd9, 0x6f, 0xfb, 0xd9, 0xb3, 0x23, 0xf6, 0x04, 0xd6, 0x07, 0xf6,
+  0xd9, 0xb1, 0x03, 0xf6, 0xcc, 0x03, 0xb0, 0xfd, 0x08, 0xb2, 0x47, 0xf0,
+  0xfc, 0xd7, 0x6f, 0xfb, 0x8c, 0xff, 0x9f, 0xfd, 0x2d, 0x96, 0x63, 0xfd,
+  0xf8, 0xbb, 0x03, 0xf6, 0x01, 0x96, 0x67, 0xf6, 0x2c, 0xfe, 0x9f, 0xfd,
+  0xd0, 0x03, 0xb0, 0xfd, 0xd7, 0xed, 0x03, 0xf6, 0x03, 0xec, 0xcf, 0xf7,
+  0x03, 0xec, 0x47, 0xa5, 0x62, 0xb0, 0x07, 0xf6, 0x98, 0x03, 0xb0, 0xfd,
+  0x1f, 0x98, 0x63, 0xfd, 0x1f, 0x98, 0x63, 0xfd, 0xf6, 0xb1, 0x03, 0xf6,
+  0x03, 0xb0, 0x27, 0xf5, 0x00, 0x00, 0x64, 0xfd, 0x00, 0xb0, 0x63, 0xfd,
+  0xe8, 0x01, 0x80, 0xff, 0x1f, 0x20, 0x65, 0xfd, 0x00, 0xec, 0x63, 0xfd,
+  0x04, 0xa4, 0x47, 0xf5, 0x90, 0xfd, 0x9f, 0xfd, 0x09, 0x3d, 0x80, 0xff,
+  0x1f, 0x00, 0x64, 0xfd, 0x02, 0xba, 0x97, 0xfb, 0x01, 0xbc, 0x67, 0xf6,
+  0x5c, 0x00, 0xb0, 0xfd, 0x40, 0x7c, 0x64, 0xfd, 0x40, 0x7e, 0x64, 0xfd,
+  0x3e, 0x00, 0x0c, 0xfc, 0x3f, 0x00, 0x0c, 0xfc, 0x02, 0xa4, 0xcf, 0xf7,
+  0x0c, 0x00, 0x90, 0x5d, 0x04, 0xa4, 0xcf, 0xf7, 0x00, 0x00, 0x64, 0x5d,
+  0x24, 0x00, 0x90, 0xfd, 0xd1, 0xed, 0x0b, 0xf6, 0x1c, 0x00, 0x90, 0xad,
+  0xd1, 0xed, 0x23, 0xf5, 0x00, 0xec, 0x63, 0xfd, 0xe8, 0x01, 0x80, 0xff,
+  0x1f, 0x20, 0x65, 0xfd, 0x03, 0xa2, 0xcf, 0xf7, 0x03, 0xa2, 0x47, 0xa5,
+  0x00, 0xa2, 0x63, 0xfd, 0x12, 0x13, 0x80, 0xff, 0x1f, 0x40, 0x67, 0xfd,
+  0x08, 0xa4, 0xcf, 0xf7, 0x8c, 0x03, 0x90, 0x5d, 0xcb, 0x01, 0xe8, 0xfc,
+  0xdd, 0xc5, 0x1b, 0xfb, 0xf8, 0xff, 0x9f, 0xcd, 0xa8, 0x02, 0x90, 0x5d,
+  0x28, 0x06, 0x64, 0xfd, 0xdd, 0xbd, 0x63, 0xfc, 0x2d, 0x00, 0x64, 0xfd,
+  0x04, 0x03, 0xb0, 0xfd, 0x00, 0x00, 0x78, 0xff, 0x00, 0xbc, 0x07, 0xf6,
+  0x02, 0x00, 0x40, 0xff, 0x00, 0xbe, 0x07, 0xf6, 0xd7, 0xc1, 0x03, 0xf6,
+  0xcc, 0xff, 0xbf, 0xfd, 0x58, 0xff, 0x9f, 0xfd, 0x9b, 0xba, 0x97, 0xfb,
+  0x6b, 0xb0, 0x07, 0xf6, 0xb8, 0x02, 0xb0, 0xfd, 0xcd, 0xf3, 0x03, 0xf6,
+  0xcd, 0xc9, 0x03, 0xf6, 0xd4, 0xcd, 0x03, 0xf6, 0xd4, 0xcf, 0x03, 0xf6,
+  0x00, 0xd0, 0x07, 0xf6, 0x00, 0xd2, 0x07, 0xf6, 0x98, 0x00, 0xb0, 0xfd,
+  0x40, 0x7e, 0x74, 0xfd, 0x24, 0x00, 0x90, 0x3d, 0x3f, 0xac, 0x8f, 0xfa,
+  0x18, 0xac, 0x47, 0xf0, 0xe1, 0xad, 0x47, 0xfc, 0xd6, 0xb3, 0x03, 0xf1,
+  0x04, 0xca, 0x6f, 0xfb, 0x01, 0xd0, 0x07, 0xf1, 0xce, 0xf3, 0x0b, 0xf2,
+  0xcd, 0xf3, 0x03, 0xa6, 0x6c, 0x00, 0xb0, 0xfd, 0x06, 0xd2, 0x97, 0xfb,
+  0xdd, 0xc5, 0x1b, 0xfb, 0xc8, 0xff, 0x9f, 0xcd, 0x18, 0x02, 0x90, 0x5d,
+  0x00, 0xd2, 0x07, 0xf6, 0x6b, 0xb0, 0x07, 0xf6, 0x54, 0x02, 0xb0, 0xfd,
+  0x02, 0xd0, 0x9f, 0xfb, 0xec, 0xcf, 0x9f, 0xfb, 0x8c, 0xfd, 0x9f, 0xfd,
+  0xcf, 0xc7, 0x03, 0xf6, 0xe7, 0xc7, 0x23, 0xf3, 0xe4, 0xbd, 0x03, 0xf6,
+  0x00, 0x00, 0x78, 0xff, 0x00, 0xbc, 0x47, 0xf5, 0xd3, 0xbf, 0x03, 0xf6,
+  0xe3, 0xc1, 0x03, 0xf6, 0x28, 0x06, 0x64, 0xfd, 0xdd, 0xbd, 0x63, 0xfc,
+  0x01, 0xd2, 0x07, 0xf6, 0x01, 0xd0, 0x87, 0xf1, 0xe3, 0xa7, 0x03, 0xf1,
+  0xe3, 0xcf, 0x83, 0xf1, 0xcf, 0xc9, 0x03, 0xf1, 0xce, 0xc9, 0x0b, 0xf2,
+  0xcd, 0xc9, 0x03, 0xa6, 0x68, 0xff, 0x9f, 0xfd, 0xcf, 0xcb, 0x03, 0xf6,
+  0xe6, 0xcb, 0x23, 0xf3, 0xe5, 0xcd, 0x83, 0x01, 0x18, 0x02, 0xb0, 0xfd,
+  0xd7, 0x9b, 0x03, 0xf6, 0x10, 0x02, 0xb0, 0xfd, 0xd7, 0x9d, 0x03, 0xf6,
+  0x08, 0x02, 0xb0, 0xfd, 0xd7, 0x9f, 0x03, 0xf6, 0xcf, 0x9d, 0x13, 0xfd,
+  0x18, 0xb0, 0x63, 0xfd, 0x10, 0xb0, 0x27, 0xf3, 0xcf, 0xb1, 0x03, 0xfd,
+  0x18, 0x9c, 0x63, 0xfd, 0xcd, 0x9d, 0x03, 0xf1, 0xc4, 0x01, 0xb0, 0xfd,
+  0x3c, 0xfc, 0x9f, 0xfd, 0xe0, 0x01, 0xb0, 0xfd, 0xd7, 0xa7, 0x03, 0xf6,
+  0xff, 0xff, 0x7f, 0xff, 0xff, 0x97, 0x0f, 0xf2, 0xd3, 0x97, 0x03, 0xa6,
+  0xcc, 0x01, 0xb0, 0xfd, 0xd7, 0xa9, 0x03, 0xf6, 0xc4, 0x01, 0xb0, 0xfd,
+  0xd7, 0xc7, 0x03, 0xf6, 0x00, 0xb2, 0x07, 0xf6, 0x00, 0xc8, 0x07, 0xf6,
+  0x00, 0xca, 0x07, 0xf6, 0x09, 0xcc, 0xc7, 0xf9, 0xd3, 0xf3, 0x03, 0xf6,
+  0x63, 0xb0, 0x07, 0xf6, 0x80, 0x01, 0xb0, 0xfd, 0x1a, 0xa8, 0x97, 0xfb,
+  0x8c, 0x00, 0xb0, 0xfd, 0xe7, 0xd5, 0x03, 0xf6, 0xea, 0xd7, 0x03, 0xf6,
+  0x04, 0xd6, 0x47, 0xf0, 0x60, 0x00, 0xb0, 0xfd, 0x04, 0xd6, 0x97, 0xfb,
+  0x74, 0x00, 0xb0, 0xfd, 0xc8, 0x00, 0xb0, 0xfd, 0x11, 0xa8, 0x97, 0xfb,
+  0xfb, 0xd7, 0x6f, 0xfb, 0x64, 0x00, 0xb0, 0xfd, 0xe7, 0xd9, 0x03, 0xf6,
+  0x5c, 0x00, 0xb0, 0xfd, 0x08, 0xce, 0x67, 0xf0, 0xe7, 0xd9, 0x43, 0xf5,
+  0xf9, 0xd9, 0xc3, 0xf2, 0xea, 0xd7, 0x03, 0xf6, 0x0f, 0xd6, 0x07, 0xf5,
+  0x28, 0x00, 0xb0, 0xfd, 0x04, 0xd6, 0x07, 0xf1, 0xec, 0xcf, 0xc3, 0xfa,
+  0x01, 0xd8, 0x07, 0xf1, 0x8c, 0x00, 0xb0, 0xfd, 0x02, 0xa8, 0x97, 0xfb,
+  0xfb, 0xd7, 0x6f, 0xfb, 0x94, 0xff, 0x9f, 0xfd, 0x15, 0xc7, 0x97, 0xfb,
+  0x20, 0x00, 0xb0, 0xfd, 0xf4, 0xff, 0x9f, 0xfd, 0x0f, 0xd6, 0x0f, 0xf2,
+  0x2d, 0x00, 0x64, 0x5d, 0x10, 0x00, 0xb0, 0xfd, 0xe7, 0xd7, 0x03, 0xf1,
+  0xff, 0xce, 0x0f, 0xf2, 0xf0, 0xff, 0x9f, 0xad, 0x2d, 0x00, 0x64, 0xfd,
+  0x00, 0xce, 0x07, 0xf6, 0x13, 0xc6, 0x97, 0xfb, 0x58, 0x00, 0xb0, 0xfd,
+  0xe5, 0xc9, 0x0b, 0xf2, 0xf4, 0xff, 0x9f, 0xad, 0xe5, 0xb1, 0x03, 0xf6,
+  0x02, 0xb0, 0x47, 0xf0, 0xd8, 0xcf, 0xa3, 0xfa, 0xe5, 0xb1, 0x03, 0xf6,
+  0x03, 0xb0, 0x07, 0xf5, 0xe7, 0xb1, 0x6f, 0xf9, 0x00, 0xce, 0xe3, 0xf8,
+  0x01, 0xca, 0x07, 0xf1, 0x01, 0xc6, 0x8f, 0xf1, 0x01, 0xcc, 0x8f, 0x51,
+  0x2d, 0x00, 0x64, 0x5d, 0xe7, 0xd1, 0x03, 0xf6, 0x6b, 0xb0, 0x07, 0xf6,
+  0xa0, 0x00, 0xb0, 0xfd, 0xe8, 0xcf, 0x03, 0xf6, 0x09, 0xcc, 0xc7, 0xf9,
+  0x2d, 0x00, 0x64, 0xfd, 0xe1, 0xcf, 0x47, 0xfc, 0xe7, 0xb3, 0x03, 0xf1,
+  0x01, 0xa8, 0x87, 0xf1, 0x40, 0x7e, 0x74, 0xfd, 0x2d, 0x00, 0x64, 0x3d,
+  0x3f, 0xac, 0x8f, 0xfa, 0x18, 0xac, 0x47, 0xf0, 0xe4, 0xb1, 0x03, 0xf6,
+  0x02, 0xb0, 0x47, 0xf0, 0xd8, 0xd1, 0xa3, 0xfa, 0xe4, 0xd3, 0x03, 0xf6,
+  0x03, 0xd2, 0x07, 0xf5, 0xe8, 0xd3, 0x67, 0xf9, 0xd6, 0x01, 0xc0, 0xf8,
+  0xd8, 0xd1, 0x33, 0xfc, 0x01, 0xc8, 0x07, 0x01, 0x68, 0xb0, 0x07, 0xf6,
+  0x4c, 0x00, 0xb0, 0xfd, 0x40, 0xfb, 0x9f, 0xfd, 0x65, 0xb0, 0x07, 0xf6,
+  0x40, 0x00, 0xb0, 0xfd, 0xe2, 0xf3, 0x03, 0xf6, 0xe1, 0xb1, 0xcf, 0xfa,
+  0x2c, 0xfb, 0x9f, 0xad, 0x30, 0x00, 0xb0, 0xfd, 0xf0, 0xff, 0x9f, 0xfd,
+  0xd9, 0xb1, 0x03, 0xf6, 0x04, 0xb0, 0x47, 0xf0, 0x0f, 0xb0, 0x07, 0xf5,
+  0x40, 0xb0, 0x07, 0xf1, 0x18, 0x00, 0xb0, 0xfd, 0xd9, 0xb1, 0x03, 0xf6,
+  0x0f, 0xb0, 0x07, 0xf5, 0x40, 0xb0, 0x07, 0xf1, 0x08, 0x00, 0xb0, 0xfd,
+  0x20, 0xb0, 0x07, 0xf6, 0x00, 0x00, 0x90, 0xfd, 0x3e, 0xb0, 0x27, 0xfc,
   0x1f, 0x28, 0x64, 0xfd, 0x40, 0x7c, 0x74, 0xfd, 0xf8, 0xff, 0x9f, 0x3d,
   0x2d, 0x00, 0x64, 0xfd, 0x40, 0x7e, 0x74, 0xfd, 0xf8, 0xff, 0x9f, 0x3d,
-  0x3f, 0x0a, 0x8e, 0xfa, 0x18, 0x0a, 0x46, 0x00, 0xec, 0xff, 0xbf, 0xfd,
-  0x05, 0x0d, 0x02, 0xf6, 0xe4, 0xff, 0xbf, 0xfd, 0x08, 0x0a, 0x66, 0xf0,
-  0x05, 0x0d, 0x42, 0xf5, 0xd8, 0xff, 0xbf, 0xfd, 0x10, 0x0a, 0x66, 0xf0,
-  0x05, 0x0d, 0x42, 0xf5, 0xcc, 0xff, 0xbf, 0xfd, 0x18, 0x0a, 0x66, 0xf0,
-  0x05, 0x0d, 0x42, 0x05, 0x40, 0x7e, 0x64, 0xfd, 0x01, 0x00, 0x80, 0xff,
-  0x1f, 0xd0, 0x67, 0xfd, 0x00, 0x00, 0x40, 0xff, 0x00, 0x12, 0x06, 0xf6,
-  0x01, 0x14, 0x06, 0xf6, 0x01, 0x14, 0xd6, 0xf7, 0x02, 0x14, 0xce, 0xf7,
-  0x00, 0x12, 0xf6, 0xfb, 0x24, 0x30, 0x60, 0xfd, 0x1a, 0x16, 0x62, 0xfd,
-  0x09, 0x13, 0xf2, 0xfb, 0x24, 0x30, 0x60, 0xfd, 0x1a, 0x7e, 0x61, 0xfd,
-  0x0b, 0x7f, 0x81, 0x01, 0xff, 0xff, 0xff, 0xff, 0x9f, 0x86, 0x01, 0x00,
-  0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00
+  0x3f, 0xac, 0x8f, 0xfa, 0x18, 0xac, 0x47, 0x00, 0xec, 0xff, 0xbf, 0xfd,
+  0xd6, 0xaf, 0x03, 0xf6, 0xe4, 0xff, 0xbf, 0xfd, 0x08, 0xac, 0x67, 0xf0,
+  0xd6, 0xaf, 0x43, 0xf5, 0xd8, 0xff, 0xbf, 0xfd, 0x10, 0xac, 0x67, 0xf0,
+  0xd6, 0xaf, 0x43, 0xf5, 0xcc, 0xff, 0xbf, 0xfd, 0x18, 0xac, 0x67, 0xf0,
+  0xd6, 0xaf, 0x43, 0x05, 0x40, 0x7e, 0x64, 0xfd, 0x01, 0x00, 0x80, 0xff,
+  0x1f, 0xd0, 0x67, 0xfd, 0x00, 0x00, 0x40, 0xff, 0x00, 0xb4, 0x07, 0xf6,
+  0x01, 0xb6, 0x07, 0xf6, 0x01, 0xb6, 0xd7, 0xf7, 0x02, 0xb6, 0xcf, 0xf7,
+  0x00, 0xb4, 0xf7, 0xfb, 0x24, 0x30, 0x60, 0xfd, 0x1a, 0xb8, 0x63, 0xfd,
+  0xda, 0xb5, 0xf3, 0xfb, 0x24, 0x30, 0x60, 0xfd, 0x1a, 0x98, 0x63, 0xfd,
+  0xdc, 0x99, 0x83, 0x01, 0x01, 0xb0, 0x63, 0xfd, 0x07, 0xb0, 0x0f, 0xf2,
+  0x2c, 0x00, 0x90, 0xad, 0x29, 0xa4, 0x67, 0xfd, 0x00, 0x00, 0x04, 0xfb,
+  0x28, 0xa4, 0x67, 0xfd, 0x00, 0x00, 0x64, 0xfc, 0xa9, 0x22, 0xa9, 0xff,
+  0x28, 0x92, 0x66, 0xfd, 0x00, 0x0e, 0xec, 0xfc, 0x13, 0x00, 0x80, 0xff,
+  0x1f, 0x20, 0x66, 0xfd, 0x29, 0xa4, 0x67, 0xfd, 0x00, 0x00, 0x64, 0xfc,
+  0xcb, 0x01, 0xe8, 0xfc, 0x40, 0x7e, 0x64, 0xfd, 0x40, 0x7e, 0x74, 0xfd,
+  0xf8, 0xff, 0x9f, 0xcd, 0x1a, 0xb8, 0x63, 0xfd, 0x40, 0x7e, 0x74, 0xfd,
+  0xec, 0xff, 0x9f, 0xcd, 0x1a, 0xb0, 0x63, 0xfd, 0xdc, 0xb1, 0x83, 0xf1,
+  0x12, 0x13, 0x00, 0xff, 0xa0, 0xb1, 0x17, 0xf2, 0xe4, 0xff, 0x9f, 0xcd,
+  0x01, 0xb8, 0x63, 0xfd, 0x07, 0xb6, 0x07, 0xf6, 0xdc, 0xb7, 0x0b, 0xf2,
+  0x03, 0xb6, 0x63, 0x5d, 0x01, 0xb6, 0x97, 0xf1, 0xf0, 0xff, 0x9f, 0x3d,
+  0x40, 0x7e, 0x74, 0xfd, 0xf8, 0xff, 0x9f, 0x3d, 0x00, 0xba, 0x07, 0xf6,
+  0x01, 0x96, 0x67, 0xf6, 0x04, 0xa4, 0x47, 0xf5, 0x00, 0xf9, 0x9f, 0xfd,
+  0xff, 0xff, 0xff, 0xff, 0x9f, 0x86, 0x01, 0x00, 0x00, 0xf8, 0x07, 0x00,
+  0x00, 0x00, 0x08, 0x00, 0x00, 0x04, 0x00, 0x00, 0x20, 0x83, 0xb8, 0xed
 };
-unsigned int MainLoader_chip_bin_len = 1024;
+unsigned int MainLoader_chip_bin_len = 1860;
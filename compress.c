@@ -0,0 +1,145 @@
+/*
+ * @file compress.c
+ *
+ * LZ compression of download data for the P2 fast loader
+ *
+ * Copyright (c) 2024 Total Spectrum Software Inc.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+  */
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+
+#define MIN_MATCH  4
+#define MAX_OFFSET 65535
+#define HASH_BITS  14
+
+static uint32_t
+read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned
+hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* write the extra bytes of a length that did not fit in its nibble */
+static uint8_t *
+put_length(uint8_t *dst, int len)
+{
+    while (len >= 255) {
+        *dst++ = 255;
+        len -= 255;
+    }
+    *dst++ = len;
+    return dst;
+}
+
+/*
+ * emit one sequence: litlen literals from lit, followed by a match
+ * (if matchlen is non-zero)
+ * returns the new output pointer, or NULL if there is no room
+ */
+static uint8_t *
+put_sequence(uint8_t *dst, uint8_t *dstend, const uint8_t *lit, int litlen, int offset, int matchlen)
+{
+    uint8_t *token = dst++;
+    int mlcode = matchlen ? matchlen - MIN_MATCH : 0;
+
+    /* worst case size of what follows the token */
+    if (dst + litlen + litlen/255 + 1 + 2 + mlcode/255 + 1 > dstend) {
+        return NULL;
+    }
+    *token = ((litlen < 15) ? litlen : 15) << 4;
+    if (litlen >= 15) {
+        dst = put_length(dst, litlen - 15);
+    }
+    memcpy(dst, lit, litlen);
+    dst += litlen;
+    if (!matchlen) {
+        return dst;
+    }
+    *dst++ = offset & 0xff;
+    *dst++ = (offset >> 8) & 0xff;
+    *token |= (mlcode < 15) ? mlcode : 15;
+    if (mlcode >= 15) {
+        dst = put_length(dst, mlcode - 15);
+    }
+    return dst;
+}
+
+int
+lz_compress(const uint8_t *src, int srclen, uint8_t *dst, int dstmax)
+{
+    int *table;
+    int i, anchor;
+    uint8_t *out = dst;
+    uint8_t *outend = dst + dstmax;
+
+    table = malloc((1<<HASH_BITS) * sizeof(int));
+    if (!table) {
+        return -1;
+    }
+    for (i = 0; i < (1<<HASH_BITS); i++) {
+        table[i] = -1;
+    }
+    i = anchor = 0;
+    while (i + MIN_MATCH <= srclen) {
+        uint32_t v = read32(src + i);
+        unsigned h = hash32(v);
+        int cand = table[h];
+        int len;
+
+        table[h] = i;
+        if (cand < 0 || i - cand > MAX_OFFSET || read32(src + cand) != v) {
+            i++;
+            continue;
+        }
+        len = MIN_MATCH;
+        while (i + len < srclen && src[cand + len] == src[i + len]) {
+            len++;
+        }
+        out = put_sequence(out, outend, src + anchor, i - anchor, i - cand, len);
+        if (!out) {
+            free(table);
+            return -1;
+        }
+        i += len;
+        anchor = i;
+        /* remember a position near the end of the match too */
+        if (i - 2 + MIN_MATCH <= srclen) {
+            table[hash32(read32(src + i - 2))] = i - 2;
+        }
+    }
+    free(table);
+    if (anchor < srclen) {
+        out = put_sequence(out, outend, src + anchor, srclen - anchor, 0, 0);
+        if (!out) {
+            return -1;
+        }
+    }
+    return out - dst;
+}
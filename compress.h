@@ -0,0 +1,52 @@
+/*
+ * @file compress.h
+ *
+ * LZ compression of download data for the P2 fast loader
+ *
+ * Copyright (c) 2024 Total Spectrum Software Inc.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef COMPRESS_H__
+#define COMPRESS_H__
+
+#include <stdint.h>
+
+/*
+ * The compressed format is the LZ4 block format: a sequence of
+ *   token byte: high nibble = literal count, low nibble = match length - 4
+ *   (if the literal count is 15, more bytes follow and are added to it,
+ *    until a byte that is not 255)
+ *   the literal bytes
+ *   2 byte little endian match offset (1 to 65535)
+ *   (if the match length nibble is 15, more bytes follow as for literals)
+ * The stream ends as soon as the expected number of bytes has been
+ * produced, which may be after either the literals or a match.
+ */
+
+/*
+ * compress srclen bytes from src into dst, which has room for dstmax bytes
+ * returns the compressed size, or -1 if it would not fit
+ */
+int lz_compress(const uint8_t *src, int srclen, uint8_t *dst, int dstmax);
+
+#endif
@@ -31,8 +31,14 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include "osint.h"
 #include "loadelf.h"
+#include "compress.h"
+#include "server.h"
 
 #define ARGV_ADDR  0xFC000
 #define ARGV_MAGIC ('A' | ('R' << 8) | ('G'<<16) | ('v'<<24))
@@ -53,6 +59,7 @@
 #define ROUND_UP(x) (((x)+3) & ~3)
 
 static int loader_baud = 2000000;
+static int fast_baud = 0;       /* if non-zero, baud rate to switch to after stage 1 */
 static int clock_mode = -1;
 static int user_baud = 115200;
 static int clock_freq = 80000000;
@@ -69,6 +76,19 @@ static bool load_to_flash = false;
 
 int get_loader_baud(int ubaud, int lbaud);
 static void RunScript(char *script);
+static int probeP2(char *Port, int retries);
+
+// what a command line asks for, apart from the options kept in globals
+struct run_request {
+    int runterm;
+    int pstmode;
+    char *fname;
+    char *port;
+    int address;
+    char *u9root;
+};
+static void parseOptions(int argc, char **argv, struct run_request *req);
+static int runRequest(struct run_request *req);
 
 #if defined(__CYGWIN__) || defined(__MINGW32__) || defined(__MINGW64__)
   #define PORT_PREFIX "com"
@@ -82,6 +102,14 @@ static void RunScript(char *script);
   #include <dirent.h>
 #endif
 
+#ifndef __MINGW32__
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <unistd.h>
+  #include <sys/stat.h>
+  #include <sys/wait.h>
+#endif
+
 #include "MainLoader_chip.h"
 #include "flash_loader.h"
 #include "himem_flash.h"
@@ -96,6 +124,31 @@ int waitAtExit = 0;
 static int force_zero = 0;  /* default to zeroing memory */
 static int do_hwreset = 1;
 static int fifo_size = DEFAULT_FIFO_SIZE;
+static int fifo_given = 0;    /* -FIFO was used */
+static int calibrate = 0;     /* measure the adapter's FIFO */
+static int chunk_size = 4096; /* size of chunks sent to himem */
+static int use_compress = 1;  /* compress data sent to HUB */
+static int delta_mode = 0;    /* only send HUB blocks which changed */
+static int scan_ports = 0;    /* just list the P2s found */
+static int resident = 0;      /* leave the loader running in a cog */
+static int gang_mode = 0;     /* load many boards at once */
+static int gang_board = 0;    /* we are the process for one of them */
+static char *batch_list = NULL;   /* file listing the tests to run */
+static char *batch_dir = "batch-results";
+static int batch_timeout = 60;    /* seconds allowed for each test */
+static int batch_fd = -1;         /* tells the batch runner the test is loaded */
+static char *capture_path = NULL; /* write raw device output here */
+static int pipe_data = 0;         /* pass stdin/stdout through untouched */
+static long long capture_rotate_bytes = 0; /* start a new file at this size */
+static int capture_rotate_secs = 0;        /* or after this many seconds */
+static int capture_stamps = 0;             /* keep a .idx file of arrival times */
+static char p2_port[1024];    /* port a P2 last answered on */
+
+#define MAX_SERVE_PORTS 16
+static char *serve_path = NULL; /* socket to serve requests on */
+static char *serve_ports[MAX_SERVE_PORTS];
+static int nserve_ports = 0;
+static char *open_port = NULL;  /* port opened for us by the server */
 
 static uint8_t *himem_bin;
 static uint32_t himem_size;
@@ -103,6 +156,21 @@ static bool himem_is_flash; /* for translating -FLASH */
 
 int ignoreEof = 0;
 
+/* report how far a -GANG load has got for this board */
+static void progress(const char *fmt, ...)
+{
+    va_list args;
+
+    if (!gang_board) {
+        return;
+    }
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+    fflush(stdout);
+}
+
 /* duplicate a string, useful if our original string might
  * not be modifiable
  */
@@ -144,6 +212,7 @@ usage: loadp2\n\
          [ -p port ]               serial port\n\
          [ -b baud ]               user baud rate (default is %d)\n\
          [ -l baud ]               loader baud rate (default is %d)\n\
+         [ -FASTBAUD baud ]        switch to clkmode and this baud rate after stage 1\n\
          [ -f clkfreq ]            clock frequency (default is %d)\n\
          [ -m clkmode ]            clock mode in hex (default is %02x)\n\
          [ -s address ]            starting address in hex (default is 0)\n\
@@ -155,6 +224,15 @@ usage: loadp2\n\
          [ -n ]                    no reset; skip any hardware reset\n\
          [ -9 dir ]                serve 9p remote filesystem from dir\n\
          [ -FIFO bytes]            modify serial FIFO size (default is %d bytes)\n\
+         [ -CALIBRATE ]            measure the serial adapter's FIFO and remember it\n\
+         [ -SCAN ]                 list every P2 found on the serial ports and exit\n\
+         [ -RESIDENT ]             leave the loader in cog 7; reload later with -n -RESIDENT\n\
+         [ -GANG ]                 load every port given with -p (or every P2 found) at once\n\
+         [ -BATCH list ]           run each program in list with -t -q on the next free board\n\
+         [ -BATCHDIR dir ]         where -BATCH puts logs and summary.tsv (default batch-results)\n\
+         [ -TIMEOUT secs ]         time allowed for each -BATCH test (default 60)\n\
+         [ -SERVE socket ]         keep the ports (-p, may be repeated) open and take requests on socket\n\
+         [ -CLIENT socket ]        have the loadp2 -SERVE on socket carry out this command\n\
          [ -? ]                    display a usage message and exit\n\
          [ -DTR ]                  use DTR for reset (default)\n\
          [ -RTS ]                  use RTS for reset\n\
@@ -167,7 +245,16 @@ usage: loadp2\n\
          [ -SINGLE ]               set load mode for single stage\n\
          [ -FLASH ]                program application to SPI flash\n\
          [ -NOEOF ]                ignore EOF on input\n\
+         [ -CAPTURE file ]         write raw output from the P2 to file until Ctrl-C\n\
+         [ -ROTATE size ]          start a new numbered -CAPTURE file at this size (k, M, G)\n\
+         [ -ROTATESECS secs ]      start a new numbered -CAPTURE file after this long\n\
+         [ -STAMP ]                give each -CAPTURE file a .idx of host arrival times\n\
+         [ -PIPE ]                 pass stdin and stdout to and from the P2 untouched\n\
+         [ -HEX ]                  use Prop_Hex instead of Prop_Txt for ROM downloads\n\
          [ -HIMEM=flash ]          addresses 0x8000000 and up refer to flash\n\
+         [ -CHUNK bytes ]          size of chunks sent to himem, 1024 to 16384 (default 4096)\n\
+         [ -NOCOMPRESS ]           do not compress data sent to HUB memory\n\
+         [ -DELTA ]                only send HUB blocks that differ from what is there\n\
          filespec                  file to load\n\
          [ -e script ]             send a sequence of characters after starting P2\n\
          [ -a arg1 [arg2 ...] ]    put arguments for program into memory\n\
@@ -203,24 +290,107 @@ void tx_raw_long(unsigned int size)
     tx((uint8_t *)buffer, 4);
 }
 
-void txbyte(int val)
+//
+// data sent to the boot ROM is encoded either as base64 (Prop_Txt) or
+// as hex (Prop_Hex); base64 needs 4 characters for every 3 bytes,
+// where hex needs 3 characters per byte
+//
+#define ROM_TXT 0
+#define ROM_HEX 1
+
+static int rom_format = ROM_TXT;
+
+static const char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char rom_out[1024];  /* encoded characters waiting to be sent */
+static int rom_outlen;
+static uint32_t rom_bits;   /* base64 bits not yet encoded */
+static int rom_nbits;
+static int rom_count;       /* bytes encoded since last autobaud marker */
+
+static void rom_flush(void)
+{
+    if (rom_outlen > 0) {
+        tx((uint8_t *)rom_out, rom_outlen);
+        rom_outlen = 0;
+    }
+}
+
+static void rom_putc(int c)
 {
-    sprintf(buffer, " %2.2x", val&255);
-    tx((uint8_t *)buffer, strlen(buffer));
+    if (rom_outlen == sizeof(rom_out)) {
+        rom_flush();
+    }
+    rom_out[rom_outlen++] = c;
 }
 
-void txval(int val)
+// start a ROM download command
+static void rom_begin(void)
 {
-    sprintf(buffer, " %2.2x %2.2x %2.2x %2.2x",
-        val&255, (val >> 8) & 255, (val >> 16) & 255, (val >> 24) & 255);
-    tx((uint8_t *)buffer, strlen(buffer));
+    static const char *cmd[] = { "> Prop_Txt 0 0 0 0 ", "> Prop_Hex 0 0 0 0" };
+    const char *s = cmd[rom_format];
+
+    rom_outlen = rom_nbits = rom_count = 0;
+    rom_bits = 0;
+    while (*s) {
+        rom_putc(*s++);
+    }
 }
 
-void txstring(unsigned char *bytes, int len)
+// encode and queue some bytes for the ROM
+// a " > " autobaud marker is inserted every so often; in base64 mode
+// this happens only between complete 4 character groups
+static void rom_data(const uint8_t *data, int len)
 {
+    static const char hexdigits[] = "0123456789abcdef";
+    int marker = (rom_format == ROM_TXT) ? 96 : 128;
+
     while (len-- > 0) {
-        txbyte(*bytes++);
+        unsigned c = *data++;
+        if (rom_format == ROM_TXT) {
+            rom_bits = (rom_bits << 8) | c;
+            rom_nbits += 8;
+            while (rom_nbits >= 6) {
+                rom_nbits -= 6;
+                rom_putc(base64_chars[(rom_bits >> rom_nbits) & 0x3f]);
+            }
+        } else {
+            rom_putc(' ');
+            rom_putc(hexdigits[c >> 4]);
+            rom_putc(hexdigits[c & 0xf]);
+        }
+        if (++rom_count == marker) {
+            rom_putc(' ');
+            rom_putc('>');
+            rom_putc(' ');
+            rom_count = 0;
+        }
+    }
+}
+
+static void rom_long(uint32_t val)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = val & 0xff;
+    bytes[1] = (val >> 8) & 0xff;
+    bytes[2] = (val >> 16) & 0xff;
+    bytes[3] = (val >> 24) & 0xff;
+    rom_data(bytes, 4);
+}
+
+// finish a ROM download with the terminating character
+// (either '~' to just run, or '?' to check the checksum first)
+static void rom_end(int term)
+{
+    if (rom_nbits > 0) {
+        // flush remaining base64 bits, padded with 0
+        rom_putc(base64_chars[(rom_bits << (6 - rom_nbits)) & 0x3f]);
+        rom_nbits = 0;
     }
+    rom_putc(term);
+    rom_flush();
 }
 
 int compute_checksum(int *ptr, int num)
@@ -357,698 +527,2856 @@ sendAddressSize(uint32_t address, uint32_t size)
 // keeps track of HUB memory limit, for use when flashing
 static uint32_t g_highest_hub_addr = 0;
 
+// data for himem (e.g. flash) is sent in chunks, which the device
+// buffers in HUB below the himem kernel at $FC000 (== $7C000)
+#define HIMEM_BUF_TOP 0x7C000
+// if there is no room there, fall back to the top 2K of HUB
+#define HIMEM_LEGACY_BUF 0x7F800
+
+static uint32_t himem_window = 2;    // number of device buffers
+static uint32_t himem_chunk = 1024;  // size of each device buffer
+static uint32_t himem_bufbase = HIMEM_LEGACY_BUF;
+static uint32_t himem_buflen = 2048;
+
 //
-// download a block of data to the device at address 'address'
-// returns bytes sent to device
+// tell the device where to buffer himem chunks; we use the HUB memory
+// above anything downloaded so far, so as not to overwrite it
+// returns 0 on success, -1 on failure
 //
 static int
-downloadData(uint8_t *data, uint32_t address, uint32_t size)
+setupHimemWindow(void)
 {
-    int num, i;
-    unsigned chksum = 0;
-    int sent = 0;
-    int mode;
+    uint32_t base = (g_highest_hub_addr + 255) & ~255;
+    uint32_t len = (base < HIMEM_BUF_TOP) ? HIMEM_BUF_TOP - base : 0;
+    uint32_t chunk = chunk_size;
+    uint8_t resp[1];
+    int r;
 
-    if (size == 0) {
-        if (verbose) printf("Skipping 0 size download at address 0x%08x\n", address);
-        return 0;
+    while (chunk > 1024 && len < 2*chunk) {
+        chunk /= 2;
     }
-    if ( address == 0 && patch_mode && size >= 0x40) {
-        memcpy(data+0x14, &clock_freq, 4);  /* assumes little-endian host! */
-        memcpy(data+0x18, &clock_mode, 4);
-        memcpy(data+0x1c, &user_baud, 4);
-        patch_mode = 0;
+    if (len < 2*chunk) {
+        base = HIMEM_LEGACY_BUF;
+        len = 2048;
+        chunk = 1024;
     }
-    // update hub memory limit
-    if (address <= 0x7ffff) {
-        uint32_t endaddr = address + size;
-        if (g_highest_hub_addr < endaddr)
-            g_highest_hub_addr = endaddr;
+    if (base == himem_bufbase && len == himem_buflen && chunk == himem_chunk) {
+        return 0; // device is already set up this way
     }
-    // send header to device
-    mode = sendAddressSize(address, size);
-    if (mode == 'h') {
-        printf("No himem kernel loaded, but address requires it; did you forget -HIMEM=flash\n");
-        promptexit(1);
+    tx_raw_byte('W');
+    tx_raw_long(base);
+    tx_raw_long(len);
+    tx_raw_long(chunk);
+    r = rx_timeout(resp, 1, 1000);
+    if (r != 1 || resp[0] == 0) {
+        printf("Device did not accept himem buffer setup\n");
+        return -1;
     }
-    if (mode != 's' && mode != 'k') {
-        printf("Device reported unknown mode '%c'\n", mode);
-        promptexit(1);
+    himem_window = resp[0];
+    himem_chunk = chunk;
+    himem_bufbase = base;
+    himem_buflen = len;
+    if (verbose) printf("himem buffers: %u x %u bytes at 0x%05x\n", himem_window, himem_chunk, base);
+    return 0;
+}
+
+//
+// wait up to timeout ms for the device to finish with one of its buffers
+// returns 0 on success, -1 on error
+//
+static int
+waitCredit(int timeout)
+{
+    uint8_t resp[4];
+    int mode;
+    int r = rx_timeout(resp, 1, timeout);
+
+    if (r != 1) {
+        printf("timeout while sending data to device\n");
+        return -1;
+    }
+    mode = resp[0];
+    if (mode == 'k') {
+        return 0;
+    }
+    if (mode == 'e') {
+        // read the error message
+        uint8_t errmsg[256];
+        memset(errmsg, 0, sizeof(errmsg));
+        r = rx_timeout(errmsg, 255, 2000);
+        if (r < 0) r = 0;
+        errmsg[r] = 0;
+        printf("Error from device: %s\n", errmsg);
+    } else {
+        printf("Unexpected response '%c' from device\n", mode);
     }
-    if (verbose && mode == 'k') {
+    return -1;
+}
+
+//
+// send data in blocks of "block" bytes to a device which has "window"
+// buffers, all free right now; it sends a 'k' each time one of them
+// is finished with, and we wait for all of them at the end
+// returns 0 on success, -1 on error
+//
+static int
+sendWindowed(const uint8_t *data, uint32_t size, uint32_t block, uint32_t window, int timeout)
+{
+    uint32_t credits = window;
+    uint32_t nblocks = 0;
+    uint32_t acked = 0;
+    uint32_t num;
+
+    if (verbose) {
         printf("Sending blocks: "); fflush(stdout);
     }
-    chksum = 0;
     while (size > 0) {
-        num = (size > 1024) ? 1024 : size;
-        if (!num) break;
-        if (verbose && mode == 'k') {
-            printf("."); fflush(stdout);
+        num = (size > block) ? block : size;
+        while (credits == 0) {
+            if (waitCredit(timeout) < 0) {
+                return -1;
+            }
+            credits++;
+            acked++;
         }
-        tx(data, num);
-        for (i = 0; i < num; i++) {
-            chksum += *data++;
+        credits--;
+        nblocks++;
+        if (verbose) {
+            printf("."); fflush(stdout);
         }
+        tx((uint8_t *)data, num);
+        data += num;
         size -= num;
-        sent += num;
-        if (size && mode == 'k') {
-            // wait for device to signal it is ready
-            // we may have to wait a long time
-            uint8_t resp[4];
-            int r = rx_timeout(resp, 1, 10000);
-            if (r != 1) {
-                printf("timeout while sending data to device\n");
-                return -1;
-            } else {
-                mode = resp[0];
-            }
-            if (mode != 'k') {
-                if (mode == 'e') {
-                    // read the error message
-                    uint8_t errmsg[256];
-                    memset(errmsg, 0, sizeof(errmsg));
-                    int r = rx_timeout(errmsg, 255, 2000);
-                    if (r < 0) r = 0;
-                    errmsg[r] = 0;
-                    printf("Error from device: %s\n", errmsg);
-                } else {
-                    printf("Unexpected response '%c' from device\n", mode);
-                }
-                return -1;
-            }
+    }
+    if (verbose) printf("\n");
+    while (acked < nblocks) {
+        if (waitCredit(timeout) < 0) {
+            return -1;
         }
+        acked++;
     }
-    // now verify the chksum
-    verify_chksum(chksum);
-    
-    return sent;
+    return 0;
 }
 
 //
-// send a block of 'size' bytes from a file and send to device at address
-// 'address'
+// everything we have sent to HUB memory, so that it can be checked
+// (and repaired) before the program is started
 //
-uint8_t *
-loadBytesFromFileAtOffset(FILE *infile, uint32_t offset, uint32_t size)
+struct hub_range {
+    struct hub_range *next;
+    uint32_t addr;
+    uint32_t size;
+    uint8_t *data;
+};
+static struct hub_range *hub_image;
+static int hub_suspect;  // a transfer to HUB failed its checksum
+
+//
+// remember that size bytes of data (or zeros, if data is NULL) are
+// going to HUB at addr
+//
+static void
+recordHubRange(const uint8_t *data, uint32_t addr, uint32_t size)
 {
-    uint8_t *localBuf;
-    int num;
-    int r;
-    
-    r = fseek(infile, offset, SEEK_SET);
-    if (r != 0) {
-        printf("Error seeking in file\n");
-        return NULL;
+    struct hub_range *r, **last = &hub_image;
+    uint32_t lo, hi;
+
+    // the new data replaces anything sent there before
+    for (r = hub_image; r; r = r->next) {
+        lo = (r->addr > addr) ? r->addr : addr;
+        hi = (r->addr + r->size < addr + size) ? r->addr + r->size : addr + size;
+        if (lo < hi) {
+            if (data) {
+                memcpy(r->data + (lo - r->addr), data + (lo - addr), hi - lo);
+            } else {
+                memset(r->data + (lo - r->addr), 0, hi - lo);
+            }
+        }
+        last = &r->next;
     }
-    // get memory; round up to next longword
-    localBuf = calloc(1, (size+3)&~3);
-    if (!localBuf) {
+    r = calloc(1, sizeof(*r));
+    if (r) {
+        r->data = calloc(1, size);
+    }
+    if (!r || !r->data) {
         printf("Unable to allocate %u bytes\n", size);
-        return NULL;
+        promptexit(1);
     }
-    num = fread(localBuf, 1, size, infile);
-    if (num != (int)size) {
-        printf("Error reading data: expected %u bytes, got %d\n", size, num);
-        return NULL;
+    if (data) {
+        memcpy(r->data, data, size);
     }
-    return localBuf;
+    r->addr = addr;
+    r->size = size;
+    *last = r;
 }
 
 //
-// try loading the individual sections of an ELF file
-// returns the number of bytes loaded, or -1 if there was an error
+// check the device's checksum after a transfer; bad HUB data can be
+// repaired later, anything else is fatal
 //
-#define BOOT_MAGIC 0x706F7250 /* little endian "Prop" */
+static void
+checkChksum(unsigned chksum, uint32_t address, uint32_t size)
+{
+    if (verify_chksum(chksum) == 0) {
+        return;
+    }
+    if (address + size <= HIMEM_BUF_TOP) {
+        if (verbose) printf("will resend bad blocks at 0x%08x\n", address);
+        hub_suspect = 1;
+        return;
+    }
+    printf("ERROR: transfer to 0x%08x failed\n", address);
+    promptexit(1);
+}
 
+// compressed data goes to a 2K ring on the device, 512 bytes at a time
+#define LZ_BLOCK 512
+#define LZ_WINDOW 4
+// don't bother unless we save at least 1/8 of the data
+#define LZ_MIN_SIZE 256
+
+//
+// get back in step with the loader after a compressed download went
+// wrong: it may still be waiting for (lost) data, so send it enough
+// NULs to finish, which it ignores once it is back to reading
+// requests; then throw away whatever it said and check that it
+// answers an 'E' request again
+// returns 0 on success, -1 if the loader is not listening
+//
 static int
-loadElfSections(const char *fname)
+resyncLoader(uint32_t pad)
 {
-    ElfHdr hdr;
-    ElfContext *c;
-    ElfProgramHdr program;
-    int i, size;
-    FILE *f = fopen(fname, "rb");
-    uint32_t ram_offset = 0;
-    
-    if (!f) return -1;
-    if (!ReadAndCheckElfHdr(f, &hdr)) {
-        // not an ELF file
-        fclose(f);
+    static uint8_t zeros[1024];
+    uint8_t resp[3];
+    uint32_t num;
+
+    while (pad > 0) {
+        num = (pad > sizeof(zeros)) ? sizeof(zeros) : pad;
+        tx(zeros, num);
+        pad -= num;
+    }
+    wait_drain();
+    while (rx_timeout(resp, sizeof(resp), 200 + fifo_size*10000/loader_baud) > 0)
+        ;
+    tx_raw_byte('E');
+    tx_raw_long(1);
+    tx_raw_byte(0x5a);
+    if (rx_exact(resp, 3, 1000) != 3 || resp[0] != '@' + 5 || resp[1] != '@' + 10) {
         return -1;
     }
-    c = OpenElfFile(f, &hdr);
-    if (!c) {
-        fclose(f);
+    return 0;
+}
+
+//
+// try sending HUB data compressed; the device expands it as it arrives
+// returns bytes sent to device, 0 if compression was not worthwhile
+// (nothing has been sent then), or -1 on error
+//
+static int
+downloadCompressed(const uint8_t *data, uint32_t address, uint32_t size)
+{
+    uint8_t *cdata;
+    uint8_t resp[1];
+    unsigned chksum = 0;
+    uint32_t i;
+    int csize;
+    int r;
+
+    if (!use_compress || size < LZ_MIN_SIZE) {
+        return 0;
+    }
+    cdata = malloc(size);
+    if (!cdata) {
+        return 0;
+    }
+    csize = lz_compress(data, size, cdata, size - size/8);
+    if (csize <= 0) {
+        free(cdata);
+        return 0;
+    }
+    if (verbose) printf("address=0x%08x size=%x compressed=%x\n", address, size, csize);
+    tx_raw_byte('C');
+    tx_raw_long(address);
+    tx_raw_long(size);
+    tx_raw_long(csize);
+    r = rx_timeout(resp, 1, 500);
+    if (r != 1 || resp[0] != 'c') {
+        printf("Device did not accept compressed download\n");
+        free(cdata);
         return -1;
     }
-    /* walk through the program table, loading to the device */
-    size = 0;
-    for (i = 0; i < c->hdr.phnum; i++) {
-        uint32_t addr;
-        uint8_t *data;
-        if (!LoadProgramTableEntry(c, i, &program)) {
-            printf("Error reading ELF program header %d\n", i);
-            continue;
-        }
-        if (program.type != PT_LOAD) {
-            continue;
-        }
-        if (program.filesz == 0) {
-            continue;
+    // the loader answers each block quickly, so if it goes quiet
+    // it has lost some data and is waiting for more
+    r = sendWindowed(cdata, csize, LZ_BLOCK, LZ_WINDOW, 2000 + fifo_size*10000/loader_baud);
+    free(cdata);
+    if (r < 0) {
+        // the loader never needs more than csize bytes, plus any that
+        // were lost on the way
+        printf("Compressed download to 0x%08x failed, resyncing\n", address);
+        if (resyncLoader(csize + LZ_BLOCK) < 0) {
+            printf("ERROR: device stopped responding\n");
+            promptexit(1);
         }
-        if (verbose) printf("load %d bytes at 0x%x\n", program.filesz, program.paddr);
-        data = loadBytesFromFileAtOffset(f, program.offset, program.filesz);
-        if (!data) {
-            printf("Error loading program header %d\n", i);
-            fclose(f);
-            return -1;
+        if (address + size > HIMEM_BUF_TOP) {
+            printf("ERROR: transfer to 0x%08x failed\n", address);
+            promptexit(1);
         }
-        addr = program.paddr;
-        if (addr < 0x800000)
-            addr += ram_offset;
-        size += downloadData(data, addr, program.filesz);
-        free(data);
+        hub_suspect = 1;
+        return csize;
     }
-    fclose(f);
-    return size;
+    for (i = 0; i < size; i++) {
+        chksum += data[i];
+    }
+    checkChksum(chksum, address, size);
+    return csize;
 }
 
-/*
- * read a simple binary file into memory
- * sets g_filedata to point to the data, 
- * and g_filesize to the length
- * returns g_filesize, or -1 on error
- * if prepend_data is non-NULL and prepend_size > 0,
- * then that data is prepended to the total to be downloaded
- */
+//
+// have the device fill a range of HUB memory with zeros
+// returns 0 (no data bytes sent)
+//
+static int
+sendZeroFill(uint32_t address, uint32_t size)
+{
+    if (verbose) printf("zero fill address=0x%08x size=%x\n", address, size);
+    // the zeros are part of the image, just like data
+    if (address <= 0x7ffff && g_highest_hub_addr < address + size) {
+        g_highest_hub_addr = address + size;
+    }
+    tx_raw_byte('Z');
+    tx_raw_long(address);
+    tx_raw_long(size);
+    checkChksum(0, address, size);
+    return 0;
+}
 
-static int 
-readBinaryFile(char *fname, uint8_t *prepend_data, int prepend_size)
+//
+// send one range of data to the device at address 'address'
+// returns bytes sent to device
+//
+static int
+downloadRange(uint8_t *data, uint32_t address, uint32_t size)
 {
-    int size;
-    int fsize;
-    FILE *infile;
-    ElfHdr hdr;
-    uint8_t *progbase;
-    
-    g_fileptr = 0;
-    infile = fopen(fname, "rb");
-    if (!infile)
-    {
-        perror(fname);
-        return -1;
+    int num, i;
+    unsigned chksum = 0;
+    uint32_t left;
+    int sent = 0;
+    int mode;
+
+    if ((address & 0x80000000) && himem_bin) {
+        if (setupHimemWindow() < 0) {
+            return -1;
+        }
     }
-    if (ReadAndCheckElfHdr(infile, &hdr)) {
-        /* this is an ELF file, load using ReadElf instead */
-        return readElfFileToMem(infile, &hdr, prepend_data, prepend_size);
+    if (address <= 0x7ffff) {
+        sent = downloadCompressed(data, address, size);
+        if (sent != 0) {
+            return sent;
+        }
+    }
+    // send header to device
+    mode = sendAddressSize(address, size);
+    if (mode == 'h') {
+        printf("No himem kernel loaded, but address requires it; did you forget -HIMEM=flash\n");
+        promptexit(1);
+    }
+    if (mode != 's' && mode != 'k') {
+        printf("Device reported unknown mode '%c'\n", mode);
+        promptexit(1);
+    }
+    chksum = 0;
+    for (i = 0; i < (int)size; i++) {
+        chksum += data[i];
+    }
+    if (mode == 'k') {
+        // the device buffers himem data and writes it behind our back
+        // we may have to wait a long time (for flash erase, for example)
+        if (sendWindowed(data, size, himem_chunk, himem_window, 10000) < 0) {
+            return -1;
+        }
+        sent = size;
     } else {
-        //printf("not an ELF file\n");
+        for (left = size; left > 0; left -= num) {
+            num = (left > 1024) ? 1024 : left;
+            tx(data, num);
+            data += num;
+            sent += num;
+        }
     }
+    // now verify the chksum
+    checkChksum(chksum, address, size);
     
-    fseek(infile, 0, SEEK_END);
-    fsize = ftell(infile);
-    fseek(infile, 0, SEEK_SET);
-    size = ROUND_UP(fsize + prepend_size);
-    g_filedata = (uint8_t *)malloc(size);
-    if (!g_filedata) {
-        printf("Could not allocate %d bytes\n", size);
-        return -1;
+    return sent;
+}
+
+//
+// each range we send costs a round trip to the device, so only
+// runs of zeros at least this long are worth turning into fills;
+// compressed data already shrinks zeros a lot, so then the runs
+// have to be much longer
+//
+#define ZERO_RUN_MIN (use_compress ? 65536 : 4096)
+
+//
+// send data, turning long runs of zeros going to HUB into fill commands
+// returns bytes sent to device
+//
+static int
+downloadPlanned(uint8_t *data, uint32_t address, uint32_t size)
+{
+    uint32_t pos, start, end;
+    int sent = 0;
+    int r;
+
+    if (address > 0x7ffff || size < ZERO_RUN_MIN) {
+        return downloadRange(data, address, size);
     }
-    if (prepend_data && prepend_size) {
-        memcpy(g_filedata, prepend_data, prepend_size);
+    start = pos = 0;
+    while (pos < size) {
+        if (data[pos] != 0) {
+            pos++;
+            continue;
+        }
+        end = pos;
+        while (end < size && data[end] == 0) {
+            end++;
+        }
+        if (end - pos >= ZERO_RUN_MIN) {
+            if (pos > start) {
+                r = downloadRange(data + start, address + start, pos - start);
+                if (r < 0) return r;
+                sent += r;
+            }
+            sendZeroFill(address + pos, end - pos);
+            start = end;
+        }
+        pos = end;
     }
-    progbase = g_filedata + prepend_size;
-    int origFsize = fsize;
-    fsize = fread(progbase, 1, fsize, infile);
-    fclose(infile);
-    if (fsize <= 0) {
-        size = g_filesize = fsize;
-    } else {
-        if (fsize != origFsize) {
-            printf("WARNING: short read of file\n");
+    if (size > start) {
+        r = downloadRange(data + start, address + start, size - start);
+        if (r < 0) return r;
+        sent += r;
+    }
+    return sent;
+}
+
+//
+// standard (zlib) CRC32
+//
+static uint32_t
+crc32(const uint8_t *data, uint32_t len)
+{
+    static uint32_t table[256];
+    uint32_t crc = 0xffffffff;
+    uint32_t c;
+    int i, j;
+
+    if (!table[1]) {
+        for (i = 0; i < 256; i++) {
+            c = i;
+            for (j = 0; j < 8; j++) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+            }
+            table[i] = c;
         }
-        size = g_filesize = ROUND_UP(fsize + prepend_size);
     }
-    return size;
+    while (len-- > 0) {
+        crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
 }
 
-int
-loadBytesFromGBuf(char *buffer, int size)
+//
+// ask the device for the CRC32 of each blksize bytes of the size
+// bytes of HUB at addr
+// returns 0 on success, -1 on timeout
+//
+static int
+getHubCrcs(uint32_t addr, uint32_t size, uint32_t blksize, uint32_t *crcs)
 {
-    int r = 0;
-    if (!g_filedata) {
-        printf("No file data present\n");
-        return 0;
+    uint32_t n = (size + blksize - 1) / blksize;
+    uint8_t *buf = malloc(4 * n);
+    uint32_t i;
+    int r;
+
+    if (!buf) {
+        return -1;
     }
-    while (size > 0 && g_fileptr < g_filesize) {
-        *buffer++ = g_filedata[g_fileptr++];
-        --size;
-        ++r;
+    tx_raw_byte('H');
+    tx_raw_long(addr);
+    tx_raw_long(size);
+    tx_raw_long(blksize);
+    // the device takes about 1 ms per 4K at RCFAST
+    r = (rx_exact(buf, 4 * n, 1000 + size/1024) == 4 * (int)n) ? 0 : -1;
+    if (r == 0) {
+        for (i = 0; i < n; i++) {
+            uint8_t *p = buf + 4*i;
+            crcs[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+    } else {
+        printf("timeout waiting for block CRCs from device\n");
     }
+    free(buf);
     return r;
 }
 
+#define DELTA_BLOCK 4096
+
+//
+// compare HUB memory on the device with what we want to put there,
+// one 4K block at a time, and send only the blocks that differ
+// (any partial block at the end is always sent)
+// returns bytes sent to device
+//
+static int
+downloadDelta(uint8_t *data, uint32_t address, uint32_t size)
+{
+    uint32_t nblocks = size / DELTA_BLOCK;
+    uint32_t *crcs;
+    uint32_t i, run, same = 0;
+    int sent = 0;
+    int r;
+
+    if (nblocks == 0) {
+        return downloadPlanned(data, address, size);
+    }
+    crcs = malloc(4 * nblocks);
+    if (!crcs) {
+        return downloadPlanned(data, address, size);
+    }
+    if (getHubCrcs(address, DELTA_BLOCK * nblocks, DELTA_BLOCK, crcs) < 0) {
+        free(crcs);
+        return -1;
+    }
+    i = 0;
+    while (i < nblocks) {
+        // find a run of blocks which differ
+        run = 0;
+        while (i + run < nblocks) {
+            if (crcs[i + run] == crc32(data + DELTA_BLOCK * (i + run), DELTA_BLOCK)) {
+                break;
+            }
+            run++;
+        }
+        if (run) {
+            r = downloadPlanned(data + DELTA_BLOCK * i, address + DELTA_BLOCK * i, DELTA_BLOCK * run);
+            if (r < 0) {
+                free(crcs);
+                return r;
+            }
+            sent += r;
+            i += run;
+        } else {
+            same++;
+            i++;
+        }
+    }
+    free(crcs);
+    if (verbose) printf("delta: %u of %u blocks unchanged\n", same, nblocks);
+    if (size > DELTA_BLOCK * nblocks) {
+        r = downloadPlanned(data + DELTA_BLOCK * nblocks, address + DELTA_BLOCK * nblocks, size - DELTA_BLOCK * nblocks);
+        if (r < 0) return r;
+        sent += r;
+    }
+    return sent;
+}
+
+#define VERIFY_BLOCK 4096
+#define MAX_REPAIRS 4
+
+//
+// check everything we sent to HUB against a CRC32 from the device,
+// and resend any 4K blocks which did not arrive intact; the repairs
+// go uncompressed, so one bad byte cannot spoil a whole block again
+// does not return if memory cannot be repaired
+//
 static void
-patchBinaryFileForFlash(int total_size, int header_len) {
-    int size = total_size;
-    uint32_t *lptr;
-    uint32_t chksum = 0;
-    if (size & 3) {
-        printf("Error: flashing a file that is not a multiple of 4 bytes long\n");
-        promptexit(1);
+verifyHubImage(void)
+{
+    struct hub_range *r;
+    uint32_t crc, *crcs;
+    uint32_t i, n, off, len;
+    int pass, bad, suspect;
+    int save_compress = use_compress;
+
+    use_compress = 0;
+    for (pass = 0; pass <= MAX_REPAIRS; pass++) {
+        bad = 0;
+        suspect = hub_suspect;
+        hub_suspect = 0;
+        for (r = hub_image; r; r = r->next) {
+            if (!suspect) {
+                // one CRC for the whole range is enough if all is well
+                if (getHubCrcs(r->addr, r->size, r->size, &crc) < 0) {
+                    promptexit(1);
+                }
+                if (crc == crc32(r->data, r->size)) {
+                    continue;
+                }
+            }
+            n = (r->size + VERIFY_BLOCK - 1) / VERIFY_BLOCK;
+            crcs = malloc(4 * n);
+            if (!crcs || getHubCrcs(r->addr, r->size, VERIFY_BLOCK, crcs) < 0) {
+                promptexit(1);
+            }
+            for (i = 0; i < n; i++) {
+                off = i * VERIFY_BLOCK;
+                len = (r->size - off < VERIFY_BLOCK) ? r->size - off : VERIFY_BLOCK;
+                if (crcs[i] != crc32(r->data + off, len)) {
+                    if (verbose) printf("resending block at 0x%08x\n", r->addr + off);
+                    if (downloadRange(r->data + off, r->addr + off, len) < 0) {
+                        promptexit(1);
+                    }
+                    bad++;
+                }
+            }
+            free(crcs);
+        }
+        if (!bad) {
+            if (verbose) printf("HUB memory verified\n");
+            use_compress = save_compress;
+            return;
+        }
+        printf("Resent %d bad blocks\n", bad);
     }
-    lptr = (uint32_t *)g_filedata;
-    lptr[2] = 0;                    // NOP out the DEBUG flag *before* calculating checksum
-    size /= 4;
-    for (int i = 0; i < size; i++) {
-        chksum += lptr[i];
+    printf("ERROR: HUB memory still bad after %d retries\n", MAX_REPAIRS);
+    promptexit(1);
+}
+
+//
+// download a block of data to the device at address 'address'
+// returns bytes sent to device
+//
+static int
+downloadData(uint8_t *data, uint32_t address, uint32_t size)
+{
+    if (size == 0) {
+        if (verbose) printf("Skipping 0 size download at address 0x%08x\n", address);
+        return 0;
     }
-    lptr = (uint32_t *)g_filedata;  // go to the header
-    lptr[1] = -chksum;              // patch in the - chksum
+    if ( address == 0 && patch_mode && size >= 0x40) {
+        memcpy(data+0x14, &clock_freq, 4);  /* assumes little-endian host! */
+        memcpy(data+0x18, &clock_mode, 4);
+        memcpy(data+0x1c, &user_baud, 4);
+        patch_mode = 0;
+    }
+    // update hub memory limit
+    if (address <= 0x7ffff) {
+        uint32_t endaddr = address + size;
+        if (g_highest_hub_addr < endaddr)
+            g_highest_hub_addr = endaddr;
+    }
+    if (address + size <= HIMEM_BUF_TOP) {
+        recordHubRange(data, address, size);
+    }
+    if (delta_mode && address + size <= HIMEM_BUF_TOP && (address & 3) == 0) {
+        return downloadDelta(data, address, size);
+    }
+    return downloadPlanned(data, address, size);
 }
 
-int loadfilesingle(char *fname)
+//
+// the load plan: everything to be downloaded (ELF segments, files)
+// is collected first, so that neighbouring pieces can be merged and
+// sent in as few transfers as possible
+//
+struct plan_entry {
+    uint32_t addr;
+    uint32_t size;
+    uint8_t *data;  // NULL for memory to be zeroed
+    int seq;        // order in which it was added
+};
+static struct plan_entry *plan;
+static int plan_len;
+static int plan_max;
+
+// HUB pieces this close together are sent as one (with zeros between)
+#define PLAN_GAP 1024
+
+//
+// add size bytes of data (or zeros, if data is NULL) at addr to the plan
+//
+static void
+planAdd(const uint8_t *data, uint32_t addr, uint32_t size)
 {
-    int num, size, i;
-    int patch = patch_mode;
-    int checksum = 0;
+    struct plan_entry *e;
 
-    if (load_to_flash) {
-        size = readBinaryFile(fname, (uint8_t *)flash_loader_bin, flash_loader_bin_len);
-        // need to patch up the binary
-        if (size > 0) {
-            patchBinaryFileForFlash(size, flash_loader_bin_len);
+    if (size == 0) {
+        return;
+    }
+    if (plan_len == plan_max) {
+        plan_max = plan_max ? 2*plan_max : 16;
+        plan = realloc(plan, plan_max * sizeof(*plan));
+        if (!plan) {
+            printf("Unable to allocate load plan\n");
+            promptexit(1);
         }
-    } else {
-        size = readBinaryFile(fname, NULL, 0);
     }
-    if (size < 0) {
-        return 1;
+    e = &plan[plan_len];
+    e->addr = addr;
+    e->size = size;
+    e->seq = plan_len++;
+    e->data = NULL;
+    if (data) {
+        e->data = malloc(size);
+        if (!e->data) {
+            printf("Unable to allocate %u bytes\n", size);
+            promptexit(1);
+        }
+        memcpy(e->data, data, size);
     }
-    if (verbose) printf("Loading %s - %d bytes\n", fname, size);
-    tx((uint8_t *)"> Prop_Hex 0 0 0 0", 18);
+}
 
-    while ((num=loadBytesFromGBuf(binbuffer, 128)))
-    {
-        if (patch)
-        {
-            patch = 0;
-            memcpy(&binbuffer[0x14], &clock_freq, 4);
-            memcpy(&binbuffer[0x18], &clock_mode, 4);
-            memcpy(&binbuffer[0x1c], &user_baud, 4);
+static int
+planEdgeCompare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+//
+// cut the plan into pieces which do not overlap, in address order;
+// each piece belongs to the last entry added which covers it, and
+// points into that entry's data
+// returns the number of pieces, which go in *pieces (free it after)
+//
+static int
+planSplit(struct plan_entry **pieces)
+{
+    uint32_t *edge = malloc(2 * plan_len * sizeof(*edge));
+    struct plan_entry *out = malloc(2 * plan_len * sizeof(*out));
+    struct plan_entry *owner, *p;
+    int i, k, n = 0;
+
+    if (!edge || !out) {
+        printf("Unable to allocate load plan\n");
+        promptexit(1);
+    }
+    for (i = 0; i < plan_len; i++) {
+        edge[2*i] = plan[i].addr;
+        edge[2*i+1] = plan[i].addr + plan[i].size;
+    }
+    qsort(edge, 2 * plan_len, sizeof(*edge), planEdgeCompare);
+    for (k = 0; k + 1 < 2 * plan_len; k++) {
+        if (edge[k] == edge[k+1]) {
+            continue;
         }
-        if (use_checksum)
-        {
-            num = (num + 3) & ~3;
-            checksum += compute_checksum(ibin, num/4);
+        owner = NULL;
+        for (i = 0; i < plan_len; i++) {
+            if (plan[i].addr <= edge[k] && edge[k+1] <= plan[i].addr + plan[i].size
+                && (!owner || plan[i].seq > owner->seq)) {
+                owner = &plan[i];
+            }
+        }
+        if (!owner) {
+            continue; // nothing goes here
         }
-        for( i = 0; i < num; i++ )
-            sprintf( &buffer[i*3], " %2.2x", binbuffer[i] & 255 );
-        strcat(buffer, " > ");
-        tx( (uint8_t *)buffer, strlen(buffer) );
+        // carry on the last piece if it belongs to the same entry (or
+        // both are zeros)
+        p = n ? &out[n-1] : NULL;
+        if (p && p->addr + p->size == edge[k]
+            && (p->seq == owner->seq || (!p->data && !owner->data))) {
+            p->size += edge[k+1] - edge[k];
+            continue;
+        }
+        p = &out[n++];
+        p->addr = edge[k];
+        p->size = edge[k+1] - edge[k];
+        p->data = owner->data ? owner->data + (edge[k] - owner->addr) : NULL;
+        p->seq = owner->seq;
     }
-    if (use_checksum)
-    {
-        char *ptr = (char *)&checksum;
-        checksum = 0x706f7250 - checksum;
-        for( i = 0; i < 4; i++ )
-            sprintf( &buffer[i*3], " %2.2x", ptr[i] & 255 );
-        tx( (uint8_t *)buffer, strlen(buffer) );
-        tx((uint8_t *)"?", 1);
-        wait_drain();
-        //msleep(100+fifo_size*10*1000/loader_baud);
-        //num = rx_timeout((uint8_t *)buffer, 1, 100);
-        num = rx_timeout((uint8_t *)buffer, 1, 100 + fifo_size*10000/loader_baud);
-        if (num >= 0) buffer[num] = 0;
-        else buffer[0] = 0;
-        if (strcmp(buffer, "."))
-        {
-            printf("%s failed to load\n", fname);
-            printf("Error response was \"%s\"\n", buffer);
-            promptexit(1);
+    free(edge);
+    *pieces = out;
+    return n;
+}
+
+//
+// find where a group of pieces starting at index i ends; data pieces
+// close together are sent as one, zeros go on their own
+// returns the index after the group, and its end address in *endp
+//
+static int
+planGroupEnd(const struct plan_entry *p, int n, int i, uint32_t *endp)
+{
+    uint32_t end = p[i].addr + p[i].size;
+    uint32_t gap = (p[i].addr <= 0x7ffff) ? PLAN_GAP : 0;
+    int j;
+
+    for (j = i + 1; p[i].data && j < n; j++) {
+        if (!p[j].data || p[j].addr > end + gap) {
+            break;
+        }
+        // don't mix HUB and himem
+        if ((p[j].addr <= 0x7ffff) != (p[i].addr <= 0x7ffff)) {
+            break;
+        }
+        if (p[j].addr + p[j].size > end) {
+            end = p[j].addr + p[j].size;
         }
-        if (verbose)
-            printf("Checksum (0x%08x) validated\n", checksum);
     }
-    else
-    {
-        tx((uint8_t *)"~", 1);   // Added for Prop2-v28
-        wait_drain();
+    *endp = end;
+    return j;
+}
+
+//
+// send pieces [first, last), which end at end, as one block of memory
+// if split is inside the block, the part from split on goes first
+// (the loader starts the program at the first address it is sent)
+// returns bytes sent to device
+//
+static int
+planSendGroup(const struct plan_entry *p, int first, int last, uint32_t end, uint32_t split)
+{
+    uint32_t start = p[first].addr;
+    uint8_t *buf;
+    int i, r, sent;
+
+    if (split <= start || split >= end) {
+        split = start;
+    }
+    if (!p[first].data) {
+        recordHubRange(NULL, start, end - start);
+        sendZeroFill(split, end - split);
+        if (split > start) {
+            sendZeroFill(start, split - start);
+        }
+        return 0;
+    }
+    buf = calloc(1, end - start);
+    if (!buf) {
+        printf("Unable to allocate %u bytes\n", end - start);
+        promptexit(1);
+    }
+    for (i = first; i < last; i++) {
+        memcpy(buf + p[i].addr - start, p[i].data, p[i].size);
+    }
+    if (verbose && last - first > 1) {
+        printf("merged %d pieces into 0x%08x-0x%08x\n", last - first, start, end);
+    }
+    sent = downloadData(buf + (split - start), split, end - split);
+    if (sent >= 0 && split > start) {
+        r = downloadData(buf, start, split - start);
+        sent = (r < 0) ? r : sent + r;
+    }
+    free(buf);
+    return sent;
+}
+
+//
+// send everything in the plan, in address order, except that whatever
+// holds the address of the piece that was added first goes first; then
+// empty the plan
+// returns bytes sent to device, or -1 on error
+//
+static int
+planExecute(void)
+{
+    struct plan_entry *pieces;
+    uint32_t first_addr, end;
+    int i, j, n, r;
+    int sent = 0;
+    int first_group = -1;
+
+    if (plan_len == 0) {
+        return 0;
+    }
+    first_addr = plan[0].addr;
+    n = planSplit(&pieces);
+    for (i = 0; i < n; i = j) {
+        j = planGroupEnd(pieces, n, i, &end);
+        if (first_addr >= pieces[i].addr && first_addr < end) {
+            first_group = i;
+            break;
+        }
+    }
+    if (first_group < 0) {
+        // cannot happen: the first entry is in some piece
+        printf("ERROR: start address 0x%08x is not in the load plan\n", first_addr);
+        sent = -1;
+    } else {
+        j = planGroupEnd(pieces, n, first_group, &end);
+        sent = planSendGroup(pieces, first_group, j, end, first_addr);
+    }
+    for (i = 0; i < n && sent >= 0; i = j) {
+        j = planGroupEnd(pieces, n, i, &end);
+        if (i != first_group) {
+            r = planSendGroup(pieces, i, j, end, pieces[i].addr);
+            sent = (r < 0) ? r : sent + r;
+        }
+    }
+    free(pieces);
+    for (i = 0; i < plan_len; i++) {
+        free(plan[i].data);
+    }
+    plan_len = 0;
+    return sent;
+}
+
+//
+// send a block of 'size' bytes from a file and send to device at address
+// 'address'
+//
+uint8_t *
+loadBytesFromFileAtOffset(FILE *infile, uint32_t offset, uint32_t size)
+{
+    uint8_t *localBuf;
+    int num;
+    int r;
+    
+    r = fseek(infile, offset, SEEK_SET);
+    if (r != 0) {
+        printf("Error seeking in file\n");
+        return NULL;
+    }
+    // get memory; round up to next longword
+    localBuf = calloc(1, (size+3)&~3);
+    if (!localBuf) {
+        printf("Unable to allocate %u bytes\n", size);
+        return NULL;
+    }
+    num = fread(localBuf, 1, size, infile);
+    if (num != (int)size) {
+        printf("Error reading data: expected %u bytes, got %d\n", size, num);
+        return NULL;
+    }
+    return localBuf;
+}
+
+//
+// try loading the individual sections of an ELF file
+// (they are added to the load plan, see planAdd)
+// returns the number of bytes loaded, or -1 if there was an error
+//
+#define BOOT_MAGIC 0x706F7250 /* little endian "Prop" */
+
+static int
+loadElfSections(const char *fname)
+{
+    ElfHdr hdr;
+    ElfContext *c;
+    ElfProgramHdr program;
+    int i, size;
+    FILE *f = fopen(fname, "rb");
+    uint32_t ram_offset = 0;
+    
+    if (!f) return -1;
+    if (!ReadAndCheckElfHdr(f, &hdr)) {
+        // not an ELF file
+        fclose(f);
+        return -1;
+    }
+    c = OpenElfFile(f, &hdr);
+    if (!c) {
+        fclose(f);
+        return -1;
+    }
+    /* walk through the program table, loading to the device */
+    size = 0;
+    for (i = 0; i < c->hdr.phnum; i++) {
+        uint32_t addr;
+        uint8_t *data;
+        if (!LoadProgramTableEntry(c, i, &program)) {
+            printf("Error reading ELF program header %d\n", i);
+            continue;
+        }
+        if (program.type != PT_LOAD) {
+            continue;
+        }
+        addr = program.paddr;
+        if (addr < 0x800000)
+            addr += ram_offset;
+        if (program.filesz != 0) {
+            if (verbose) printf("load %d bytes at 0x%x\n", program.filesz, program.paddr);
+            data = loadBytesFromFileAtOffset(f, program.offset, program.filesz);
+            if (!data) {
+                printf("Error loading program header %d\n", i);
+                fclose(f);
+                return -1;
+            }
+            planAdd(data, addr, program.filesz);
+            size += program.filesz;
+            free(data);
+        }
+        // clear the BSS part of HUB segments instead of sending it
+        if (program.memsz > program.filesz && addr + program.memsz <= HIMEM_BUF_TOP) {
+            planAdd(NULL, addr + program.filesz, program.memsz - program.filesz);
+        }
+    }
+    fclose(f);
+    return size;
+}
+
+/*
+ * read a simple binary file into memory
+ * sets g_filedata to point to the data, 
+ * and g_filesize to the length
+ * returns g_filesize, or -1 on error
+ * if prepend_data is non-NULL and prepend_size > 0,
+ * then that data is prepended to the total to be downloaded
+ */
+
+static int 
+readBinaryFile(char *fname, uint8_t *prepend_data, int prepend_size)
+{
+    int size;
+    int fsize;
+    FILE *infile;
+    ElfHdr hdr;
+    uint8_t *progbase;
+    
+    g_fileptr = 0;
+    infile = fopen(fname, "rb");
+    if (!infile)
+    {
+        perror(fname);
+        return -1;
+    }
+    if (ReadAndCheckElfHdr(infile, &hdr)) {
+        /* this is an ELF file, load using ReadElf instead */
+        return readElfFileToMem(infile, &hdr, prepend_data, prepend_size);
+    } else {
+        //printf("not an ELF file\n");
+    }
+    
+    fseek(infile, 0, SEEK_END);
+    fsize = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+    size = ROUND_UP(fsize + prepend_size);
+    g_filedata = (uint8_t *)malloc(size);
+    if (!g_filedata) {
+        printf("Could not allocate %d bytes\n", size);
+        return -1;
+    }
+    if (prepend_data && prepend_size) {
+        memcpy(g_filedata, prepend_data, prepend_size);
+    }
+    progbase = g_filedata + prepend_size;
+    int origFsize = fsize;
+    fsize = fread(progbase, 1, fsize, infile);
+    fclose(infile);
+    if (fsize <= 0) {
+        size = g_filesize = fsize;
+    } else {
+        if (fsize != origFsize) {
+            printf("WARNING: short read of file\n");
+        }
+        size = g_filesize = ROUND_UP(fsize + prepend_size);
+    }
+    return size;
+}
+
+int
+loadBytesFromGBuf(char *buffer, int size)
+{
+    int r = 0;
+    if (!g_filedata) {
+        printf("No file data present\n");
+        return 0;
+    }
+    while (size > 0 && g_fileptr < g_filesize) {
+        *buffer++ = g_filedata[g_fileptr++];
+        --size;
+        ++r;
+    }
+    return r;
+}
+
+static void
+patchBinaryFileForFlash(int total_size, int header_len) {
+    int size = total_size;
+    uint32_t *lptr;
+    uint32_t chksum = 0;
+    if (size & 3) {
+        printf("Error: flashing a file that is not a multiple of 4 bytes long\n");
+        promptexit(1);
+    }
+    lptr = (uint32_t *)g_filedata;
+    lptr[2] = 0;                    // NOP out the DEBUG flag *before* calculating checksum
+    size /= 4;
+    for (int i = 0; i < size; i++) {
+        chksum += lptr[i];
+    }
+    lptr = (uint32_t *)g_filedata;  // go to the header
+    lptr[1] = -chksum;              // patch in the - chksum
+}
+
+int loadfilesingle(char *fname)
+{
+    int num, size;
+    int patch = patch_mode;
+    int checksum = 0;
+
+    if (load_to_flash) {
+        size = readBinaryFile(fname, (uint8_t *)flash_loader_bin, flash_loader_bin_len);
+        // need to patch up the binary
+        if (size > 0) {
+            patchBinaryFileForFlash(size, flash_loader_bin_len);
+        }
+    } else {
+        size = readBinaryFile(fname, NULL, 0);
+    }
+    if (size < 0) {
+        return 1;
+    }
+    if (verbose) printf("Loading %s - %d bytes\n", fname, size);
+    rom_begin();
+
+    while ((num=loadBytesFromGBuf(binbuffer, 128)))
+    {
+        if (patch)
+        {
+            patch = 0;
+            memcpy(&binbuffer[0x14], &clock_freq, 4);
+            memcpy(&binbuffer[0x18], &clock_mode, 4);
+            memcpy(&binbuffer[0x1c], &user_baud, 4);
+        }
+        if (use_checksum)
+        {
+            num = (num + 3) & ~3;
+            checksum += compute_checksum(ibin, num/4);
+        }
+        rom_data((uint8_t *)binbuffer, num);
+    }
+    if (use_checksum)
+    {
+        checksum = 0x706f7250 - checksum;
+        rom_long(checksum);
+        rom_end('?');
+        wait_drain();
+        //msleep(100+fifo_size*10*1000/loader_baud);
+        //num = rx_timeout((uint8_t *)buffer, 1, 100);
+        num = rx_timeout((uint8_t *)buffer, 1, 100 + fifo_size*10000/loader_baud);
+        if (num >= 0) buffer[num] = 0;
+        else buffer[0] = 0;
+        if (strcmp(buffer, "."))
+        {
+            printf("%s failed to load\n", fname);
+            printf("Error response was \"%s\"\n", buffer);
+            promptexit(1);
+        }
+        if (verbose)
+            printf("Checksum (0x%08x) validated\n", checksum);
+    }
+    else
+    {
+        rom_end('~');   // Added for Prop2-v28
+        wait_drain();
         msleep(fifo_size*10*1000/loader_baud);
     }
 
-//    msleep(100);
-    if (verbose) printf("%s loaded\n", fname);
-    return 0;
+//    msleep(100);
+    if (verbose) printf("%s loaded\n", fname);
+    return 0;
+}
+static unsigned flag_bits()
+{
+    // bit 0: zero out HUB memory
+    // bit 1: binary has been patched with correct frequency
+    // bit 3: stay resident in cog 7 (bit 2 is the loader's own)
+    return force_zero | (patch_mode << 1) | (resident << 3);
+}
+
+static char *getNextFile(char *fname, char **next_p, int *address_p)
+{
+    int address = *address_p;
+    char *next = fname;
+
+    if (!*fname) {
+        *next_p = NULL;
+        return NULL;
+    }
+    if (*fname == '@') {
+        address = strtoul(fname+1, &next, 16);
+        if (*next == '=')
+            next++;
+    }
+
+    // scan ahead to start of next fname
+    while (*fname && *fname != ',') {
+        fname++;
+    }
+    if (*fname) {
+        *fname++ = 0;
+    }
+    
+    *address_p = address;
+    *next_p = next;
+    return fname;
+}
+
+//
+// wait for the device's checksum at the end of a transfer
+// if it does not come, the device may have lost a byte and still be
+// waiting for data, so pad with NULs (which it ignores as commands)
+// returns 0 if the checksum matches, 1 if not
+//
+#define MAX_PAD_BYTES 16
+
+static int verify_chksum(unsigned chksum)
+{
+    unsigned recv_chksum = 0;
+    int num = 0;
+    int pad = 0;
+
+    wait_drain();
+    //msleep(1+fifo_size*10*1000/loader_baud);
+    //num = rx_timeout((uint8_t *)buffer, 3, 400);
+    num = rx_exact((uint8_t *)buffer, 3, 2000 + fifo_size*10000/loader_baud);
+    while (num < 3) {
+        if (num > 0 || pad >= MAX_PAD_BYTES) {
+            printf("ERROR: timeout waiting for checksum at end: got %d\n", num);
+            printf("Try increasing the FIFO setting if not large enough for your setup\n");
+            promptexit(1);
+        }
+        tx_raw_byte(0);
+        pad++;
+        num = rx_exact((uint8_t *)buffer, 3, 100);
+    }
+    if (pad && verbose) printf("device needed %d pad bytes\n", pad);
+    recv_chksum = (buffer[0] - '@') << 4;
+    recv_chksum += (buffer[1] - '@');
+    chksum &= 0xff;
+    if (pad || recv_chksum != (chksum & 0xff)) {
+        printf("bad checksum, expected %02x got %02x (chksum characters %c%c%c)\n", chksum, recv_chksum, buffer[0], buffer[1], buffer[2]);
+        return 1;
+    }
+    if (verbose) printf("chksum: %x OK\n", recv_chksum);
+    return 0;
+}
+
+// tell the user if the port could not get close to the requested
+// baud rate (drivers round to what their divisors allow)
+static void
+report_baud(const char *what, unsigned long baud)
+{
+    unsigned long actual = serial_actual_baud();
+    unsigned long diff;
+
+    if (!actual || actual == baud) {
+        return;
+    }
+    diff = (actual > baud) ? actual - baud : baud - actual;
+    if (diff * 100 > baud * 2) {
+        printf("WARNING: %s baud rate %lu is really %lu on this port\n", what, baud, actual);
+    } else if (verbose) {
+        printf("%s baud rate %lu is really %lu on this port\n", what, baud, actual);
+    }
+}
+
+//
+// wait for the fast loader to autobaud and tell us it is ready
+// "baud" is the rate we are talking at, and "startup_ms" is how long
+// the loader needs before it can start listening
+//
+// the loader ignores autobaud characters once it is running, so we
+// can keep sending them (this often) until it answers
+#define SYNC_INTERVAL 10
+
+//
+// send autobaud characters for up to timeout ms, until we receive
+// "@@ ", the loader's checksum of nothing (left in buffer)
+// returns how many bytes of that arrived
+//
+static int
+waitLoader(int timeout)
+{
+    int num = 0;
+    int r;
+    unsigned long long start, now, last_tx;
+
+    // send autobaud characters until we receive "@@ ", the loader's
+    // checksum of nothing; they queue up behind the loader itself,
+    // so there is no need to wait for that to drain first
+    wait_drain();
+    flush_input();
+    start = elapsedms();
+    last_tx = 0;
+    while (num < 3) {
+        now = elapsedms();
+        if (now - start > (unsigned long long)timeout) {
+            break;
+        }
+        if (now - last_tx >= SYNC_INTERVAL) {
+            tx_raw_byte(0x80);
+            wait_drain();
+            last_tx = now;
+        }
+        r = rx_timeout((uint8_t *)buffer + num, 3 - num, SYNC_INTERVAL);
+        if (r <= 0) {
+            continue;
+        }
+        num += r;
+        // every so often we get a 0 byte first before the checksum; if
+        // we do, throw it away
+        while (num > 0 && buffer[0] == 0) {
+            memmove(buffer, buffer + 1, --num);
+        }
+    }
+    if (verbose && num == 3) printf("loader answered after %llu ms\n", elapsedms() - start);
+    return num;
+}
+
+static void
+syncLoader(int baud, int startup_ms)
+{
+    // as long as we used to wait for the USB fifo to drain, the
+    // loader to start, and 5 tries at 210 ms each
+    int timeout = 1 + fifo_size*10*1000/baud + startup_ms + 5*210;
+    int num = waitLoader(timeout);
+
+    if (num != 3) {
+        printf("ERROR: timeout waiting for initial checksum: got %d\n", num);
+        printf("Try increasing the FIFO setting if not large enough for your setup\n");
+        promptexit(1);
+    }
+    if (buffer[0] != '@' || buffer[1] != '@') {
+        printf("ERROR: got incorrect initial chksum: %c%c%c (%02x %02x %02x)\n", buffer[0], buffer[1], buffer[2], buffer[0], buffer[1], buffer[2]);
+        promptexit(1);
+    }
+}
+
+//
+// wake up a loader left running by -RESIDENT, by sending a break
+// returns 1 if it answered
+//
+#define WAKE_BREAK_MS 250
+#define WAKE_WAIT_MS  300
+
+static int
+wakeResident(void)
+{
+    serial_break(WAKE_BREAK_MS);
+    if (waitLoader(WAKE_WAIT_MS + fifo_size*10*1000/loader_baud) != 3) {
+        return 0;
+    }
+    return buffer[0] == '@' && buffer[1] == '@';
+}
+
+//
+// a small cache of things learned about serial adapters, kept in
+// ~/.loadp2_cache; each line is "kind key value..."
+//
+static const char *
+cacheFileName(void)
+{
+    static char name[1024];
+    const char *home = getenv("HOME");
+
+    if (!home) home = getenv("USERPROFILE");
+    if (!home) return NULL;
+    snprintf(name, sizeof(name), "%s/.loadp2_cache", home);
+    return name;
+}
+
+//
+// find the value stored for kind and key
+// returns 1 if found, 0 if not
+//
+static int
+cacheLookup(const char *kind, const char *key, char *value, int len)
+{
+    const char *fname = cacheFileName();
+    char line[1024], k1[64], k2[256];
+    int n;
+    FILE *f;
+
+    if (!fname || !(f = fopen(fname, "r"))) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (sscanf(line, "%63s %255s %n", k1, k2, &n) == 2
+            && !strcmp(k1, kind) && !strcmp(k2, key))
+        {
+            snprintf(value, len, "%s", line + n);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+//
+// set the value stored for kind and key (replacing any old one)
+//
+static void
+cacheStore(const char *kind, const char *key, const char *value)
+{
+    const char *fname = cacheFileName();
+    char line[1024], k1[64], k2[256];
+    char tmpname[1100];
+    FILE *f, *out;
+
+    if (!fname) return;
+    // other loadp2 processes (e.g. -GANG) may be doing this too
+#ifdef __MINGW32__
+    snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", fname, (int)GetCurrentProcessId());
+#else
+    snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", fname, (int)getpid());
+#endif
+    out = fopen(tmpname, "w");
+    if (!out) {
+        if (verbose) printf("Unable to write %s\n", tmpname);
+        return;
+    }
+    f = fopen(fname, "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "%63s %255s", k1, k2) == 2
+                && !strcmp(k1, kind) && !strcmp(k2, key))
+            {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(f);
+    }
+    fprintf(out, "%s %s %s\n", kind, key, value);
+    fclose(out);
+#ifdef __MINGW32__
+    remove(fname);
+#endif
+    rename(tmpname, fname);
+}
+
+//
+// use any FIFO size measured earlier for this adapter by -CALIBRATE
+//
+static void
+useCachedFifo(void)
+{
+    char serial[256], value[256];
+    int size;
+
+    if (fifo_given || !serial_usb_serial(serial, sizeof(serial))) {
+        return;
+    }
+    if (cacheLookup("fifo", serial, value, sizeof(value)) && sscanf(value, "%d", &size) == 1 && size > 0) {
+        fifo_size = size;
+        if (verbose) printf("Using FIFO size %d measured for adapter %s\n", fifo_size, serial);
+    }
+}
+
+//
+// time one empty request to the fast loader
+// returns the round trip in milliseconds, or -1 if it did not answer
+//
+static int
+loaderRoundTrip(void)
+{
+    unsigned long long t0 = elapsedms();
+
+    tx_raw_byte('E');
+    tx_raw_long(0);
+    if (rx_exact((uint8_t *)buffer, 3, 1000) != 3) {
+        return -1;
+    }
+    return (int)(elapsedms() - t0);
+}
+
+//
+// report the link latency for -v; a few round trips are averaged
+// since each one is usually only a millisecond or two
+//
+#define RTT_PINGS 8
+
+static void
+reportRoundTrip(void)
+{
+    const char *info = serial_latency_info();
+    int i, ms, total = 0;
+
+    if (info) printf("%s\n", info);
+    for (i = 0; i < RTT_PINGS; i++) {
+        ms = loaderRoundTrip();
+        if (ms < 0) {
+            printf("No answer from loader when measuring round trip time\n");
+            return;
+        }
+        total += ms;
+    }
+    printf("Serial round trip %d.%d ms\n", total / RTT_PINGS, (total % RTT_PINGS) * 10 / RTT_PINGS);
+}
+
+//
+// measure how much data the serial adapter holds after tcdrain says
+// it is done, by timing the loader's reply to bytes it just swallows
+//
+#define CAL_BYTES 16384
+#define CAL_TRIES 3
+
+static void
+calibrateAdapter(int baud)
+{
+    uint8_t *data = malloc(CAL_BYTES);
+    unsigned long long tdrain, tdone;
+    int rtt = 0, linger = 0, ms;
+    int i, n;
+    char serial[256], value[64];
+
+    if (!data) return;
+    memset(data, 0x55, CAL_BYTES);
+    for (i = 0; i < CAL_TRIES; i++) {
+        // an empty request, for the round trip time
+        ms = loaderRoundTrip();
+        if (ms < 0) {
+            printf("calibration failed: no answer from loader\n");
+            free(data);
+            return;
+        }
+        if (ms > rtt) rtt = ms;
+
+        // now a big one: whatever we still have to wait for after the
+        // drain (less a round trip) was sitting in the adapter
+        tx_raw_byte('E');
+        tx_raw_long(CAL_BYTES);
+        tx(data, CAL_BYTES);
+        wait_drain();
+        tdrain = elapsedms();
+        n = rx_exact((uint8_t *)buffer, 3, 2000 + CAL_BYTES*10000/baud);
+        tdone = elapsedms();
+        if (n != 3) {
+            printf("calibration failed: no answer from loader\n");
+            free(data);
+            return;
+        }
+        ms = (int)(tdone - tdrain) - rtt;
+        if (ms > linger) linger = ms;
+    }
+    free(data);
+    // round up, and leave room for timing jitter
+    fifo_size = (int)(((long long)linger + 2) * baud / 10000);
+    if (fifo_size < 256) fifo_size = 256;
+    printf("Adapter round trip %d ms, FIFO about %d bytes\n", rtt, fifo_size);
+    if (serial_usb_serial(serial, sizeof(serial))) {
+        snprintf(value, sizeof(value), "%d %d", fifo_size, rtt);
+        cacheStore("fifo", serial, value);
+        if (verbose) printf("saved FIFO size for adapter %s\n", serial);
+    } else {
+        printf("Adapter has no USB serial number, so the result is not saved\n");
+    }
+}
+
+//
+// ask the fast loader to switch to the final clock mode, and then
+// move both ends of the link up to fast_baud for the main download
+//
+static void
+switchLoaderSpeed(void)
+{
+    uint8_t resp[1];
+    int r;
+
+    if (clock_freq / fast_baud < 4) {
+        printf("ERROR: -FASTBAUD %d is too fast for a clock frequency of %d\n", fast_baud, clock_freq);
+        promptexit(1);
+    }
+    if (verbose) printf("Switching to %d baud with clock mode %x\n", fast_baud, clock_mode);
+    tx_raw_byte('B');
+    tx_raw_long(clock_mode);
+    r = rx_timeout(resp, 1, 1000);
+    if (r != 1 || resp[0] != 'b') {
+        printf("ERROR: device did not accept the speed change\n");
+        promptexit(1);
+    }
+    if (!serial_speed(fast_baud)) {
+        printf("ERROR: unable to set port to %d baud\n", fast_baud);
+        promptexit(1);
+    }
+    report_baud("Fast loader", fast_baud);
+    syncLoader(fast_baud, 20);
+}
+
+//
+// read the files to load into the plan; this needs no connection to
+// the board, so -GANG does it once for every board
+// returns 0 on success, 1 on failure
+//
+static int plan_ready = 0;
+
+static int
+prepareFiles(char *fname, int address)
+{
+    int size;
+    char *next_fname = NULL;
+    int send_size = 0;
+
+    // we want to be able to insert '\0' characters in fname
+    // in order to break up multiple file names into different strings
+    // so we have to copy it to a duplicate buffer
+    fname = duplicate_string(fname);
+    
+    do {
+        fname = getNextFile(fname, &next_fname, &address);
+        if (!next_fname) {
+            break; /* no more files */
+        }
+        if (*next_fname == '+') {
+            next_fname++;
+            send_size = 1;
+        } else if (address == 0 && (send_size = loadElfSections(next_fname)) >= 0) {
+            if (verbose) printf("Loaded %d bytes from ELF file %s\n", send_size, next_fname);
+            continue;
+        } else {
+            send_size = 0;
+        }
+        if (send_size) {
+            // prepend the 4 byte size to the data
+            size = readBinaryFile(next_fname, (uint8_t*)&size, 4);
+        } else {
+            size = readBinaryFile(next_fname, NULL, 0);
+        }
+        if (size < 0)
+        {
+            printf("Could not open %s\n", next_fname);
+            return 1;
+        }
+
+#if 0        
+        /* patch the file data if necessary */
+        /* now happens in downloadData */
+        if (patch_mode) {
+            uint8_t *buffer = (send_size) ? g_filedata+4 : g_filedata;
+            patch_mode = 0;
+            if (g_filesize >= 0x24) {
+                memcpy(&buffer[0x14], &clock_freq, 4);
+                memcpy(&buffer[0x18], &clock_mode, 4);
+                memcpy(&buffer[0x1c], &user_baud, 4);
+            }
+        }
+#endif        
+        /* now add the file data from g_filedata to the plan */
+        if (verbose) printf("Loading %s - %d bytes\n", next_fname, size);
+        planAdd(g_filedata, address, g_filesize);
+    } while (*fname);
+    plan_ready = 1;
+    return 0;
+}
+
+int loadfile(char *fname, int address)
+{
+    int num;
+
+    if (load_mode == LOAD_SINGLE) {
+        if (address != 0) {
+            printf("ERROR: -SINGLE and -FLASH can only load at address 0\n");
+            promptexit(1);
+        }
+        if (mem_argv_bytes != 0) {
+            printf("ERROR: ARGv is not compatible with -SINGLE and -FLASH\n");
+            promptexit(1);
+        }
+        return loadfilesingle(fname);
+    }
+
+    // read the files first, so a missing one is reported before we
+    // send the loader
+    if (!plan_ready && prepareFiles(fname, address) != 0) {
+        return 1;
+    }
+
+    if (!do_hwreset && resident && wakeResident()) {
+        // the loader left by an earlier -RESIDENT load has stopped the
+        // program, and is ready for us; its options are the ones it
+        // was loaded with
+        if (verbose) printf("Resident loader answered, skipping the ROM stage\n");
+        // it keeps the himem buffers set up by its last load, so make
+        // sure setupHimemWindow() sends ours
+        himem_bufbase = himem_buflen = 0;
+    } else {
+        if (!do_hwreset && resident) {
+            // the old program is still running, so the ROM can only
+            // take the download after a reset
+            printf("No resident loader answered. It cannot see the break if the program\n"
+                   "uses P63 as a smart pin, as most programs with a serial console do.\n"
+                   "Resetting and loading from ROM\n");
+            if (!probeP2(p2_port, 50)) {
+                printf("Could not find a P2 on port %s after reset\n", p2_port);
+                promptexit(1);
+            }
+        }
+        if (verbose) {
+            printf("Loading fast loader...\n");
+        }
+        rom_begin();
+        rom_data((uint8_t *)MainLoader_chip_bin, MainLoader_chip_bin_len);
+        rom_long(clock_mode);
+        rom_long(flag_bits());
+        rom_long(0); // reserved
+        rom_long(0); // also reserved
+        rom_end('~'); // end of download
+    
+        syncLoader(loader_baud, 50);
+    }
+    progress("loader running");
+    if (fast_baud) {
+        switchLoaderSpeed();
+    }
+    if (verbose) {
+        reportRoundTrip();
+    }
+    if (calibrate) {
+        calibrateAdapter(fast_baud ? fast_baud : loader_baud);
+    }
+
+    if (load_to_flash && !himem_bin) {
+        // default to flash as himem
+        himem_bin = (uint8_t *)himem_flash_bin;
+        himem_size = himem_flash_bin_len;
+        himem_is_flash = true;
+    }
+    // if a himem helper is present, download it to $FC000 and run it
+    if (himem_bin) {
+        int size = downloadData(himem_bin, 0xFC000, himem_size);
+        if (size != himem_size) {
+            printf("Unable to download himem helper\n");
+            promptexit(1);
+        }
+        tx_raw_byte('!'); // tell device to execute this plugin
+    }
+
+    /* send all the files */
+    progress("sending files");
+    num = planExecute();
+    if (num < 0) {
+        printf("Error downloading files\n");
+        promptexit(1);
+    }
+    wait_drain();
+
+    // make sure HUB memory holds what we sent before using it
+    verifyHubImage();
+    progress("verified");
+
+    if (load_to_flash) {
+        uint8_t *bootloader;
+        uint32_t *ptr32;
+
+        /* fix up the flash bootloader ("stub") so that it knows how
+           much to load and its checksum */
+        bootloader = calloc(1, 1024);
+        if (flash_stub_bin_len > 1024) {
+            printf("Internal error, flash stub is too big to fit\n");
+            return -1;
+        }
+        memcpy(bootloader, flash_stub_bin, flash_stub_bin_len);
+
+        g_highest_hub_addr = (g_highest_hub_addr + 3) & ~3;
+        ptr32 = (uint32_t *)bootloader;
+        ptr32[2] = g_highest_hub_addr;
+
+        /* now calculate the checksum of the bootloader itself */
+        uint32_t boot_sum = 0;
+        for (int n = 0; n < 1024/4; n++) {
+            boot_sum += ptr32[n];
+        }
+        /* adjust so it will become the magic value "Prop" */
+        ptr32[1] = BOOT_MAGIC - boot_sum;
+        if (verbose) {
+            printf("highest hub address: 0x%x chksum: 0x%x\n", ptr32[2], ptr32[1]);
+        }
+        /* load boot stub to start of flash memory  */
+        progress("writing flash");
+        downloadData(bootloader, 0x80000000, 1024);
+        wait_drain();
+        if (verbose) printf("sending F 0x%08x to device\n", g_highest_hub_addr);
+        tx_raw_byte('F'); /* says to flash HUB and then start */
+        tx_raw_long(g_highest_hub_addr);
+    } else {
+        if (mem_argv_bytes) {
+            /* send ARGv info to $FC000 */
+            if (verbose) printf("sending %d arg bytes\n", mem_argv_bytes);
+            downloadData((uint8_t *)mem_argv_data, ARGV_ADDR, mem_argv_bytes);
+        }
+        tx_raw_byte('-'); /* finished with programming */
+        progress("started");
+    }
+
+    wait_drain();
+    msleep(100);
+    return 0;
+}
+
+//
+// reset the P2 on the open port and ask for its version
+// returns the version letter, or 0 if nothing answered
+//
+static volatile sig_atomic_t probe_stop = 0; // set when a probe child is told to stop
+
+static int
+probeP2(char *Port, int retries)
+{
+    char buffer[101];
+    int num;
+    int i;
+
+    hwreset();
+    msleep(20); // wait for P2 to become active
+    if (verbose) printf("trying %s...\n", Port);
+
+    for (i = 0; i < retries && !probe_stop; i++) {
+        flush_input();
+        tx((uint8_t *)"> Prop_Chk 0 0 0 0  ", 20);
+        wait_drain();
+        // the answer is "\r\nProp_Ver X\r\n"; go on as soon as it is
+        // all here, but allow for 20 chars to empty through any fifo
+        // at the loader baud rate
+        num = rx_exact((uint8_t *)buffer, 14, 60+2*20*10*1000/loader_baud);
+        buffer[num] = 0;
+        if (!strncmp(buffer, "\r\nProp_Ver ", 11))
+        {
+            return buffer[11];
+        }
+    }
+    return 0;
+}
+
+// check for a p2 on a specific port
+
+static int
+checkp2_and_init(char *Port, int baudrate, int retries)
+{
+    int version;
+    
+    if (open_port) {
+        // a loader server has the port open for us already, but the
+        // last request may have left it at another speed
+        if (!serial_speed(baudrate)) {
+            return 0;
+        }
+    } else if (!serial_init(Port, baudrate)) {
+        return 0;
+    }
+    report_baud("Loader", baudrate);
+
+    if (!do_hwreset) {
+        useCachedFifo();
+        snprintf(p2_port, sizeof(p2_port), "%s", Port);
+        return 1;
+    }
+
+    version = probeP2(Port, retries);
+    if (version)
+    {
+        if (verbose) printf("P2 version %c found on serial port %s\n", version, Port);
+        if (load_mode == -1)
+        {
+            if (version == 'B')
+            {
+                printf("ERROR: Detected FPGA, but this version of loadp2 does not support FPGA!\n");
+                promptexit(1);
+            }
+            else if (version == 'A' || version == 'G')
+            {
+                load_mode = LOAD_CHIP;
+                if (verbose) printf("Setting load mode to CHIP\n");
+            }
+            else
+            {
+                printf("Warning: Unknown version %c, assuming CHIP\n", version);
+                load_mode = LOAD_CHIP;
+            }
+        }
+        useCachedFifo();
+        snprintf(p2_port, sizeof(p2_port), "%s", Port);
+        return 1;
+    }
+    // if we get here we failed to find a chip
+    serial_done();
+    return 0;
+}
+
+//
+// print one line of the -SCAN listing
+//
+static void
+listP2(char *Port, int version)
+{
+    char serial[256];
+    int vid, pid;
+
+    if (serial_port_usb_info(Port, &vid, &pid, serial, sizeof(serial))) {
+        printf("%s: P2 version %c (USB %04x:%04x serial %s)\n", Port, version, vid, pid, serial[0] ? serial : "none");
+    } else {
+        printf("%s: P2 version %c\n", Port, version);
+    }
+}
+    
+#ifdef __MINGW32__
+// look for a p2
+// if list_all is set, print every one found and return how many there were
+int findp2(char *portprefix, int baudrate, int list_all)
+{
+    char Port[1024];
+    int i;
+    int count = 0;
+    char targetPath[1024];
+    
+    if (verbose) printf("Searching serial ports for a P2\n");
+    for (i = 1; i < 255; i++)
+    {
+        sprintf(Port, "%s%d", portprefix, i);
+        if (0==QueryDosDevice(Port, targetPath, sizeof(targetPath)))
+            continue;
+        if (!list_all)
+        {
+            if (checkp2_and_init(Port, baudrate, 50))
+                return 1;
+            continue;
+        }
+        if (serial_init(Port, baudrate))
+        {
+            int version = probeP2(Port, 50);
+            serial_done();
+            if (version) {
+                listP2(Port, version);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+#else
+//
+// USB vendors of the serial adapters used with P2 boards; ports on
+// other USB devices (modems, GPS receivers, ...) are not probed
+//
+static const int p2_usb_vendors[] = {
+    0x0403, // FTDI (Prop Plug, P2 Eval and Edge boards)
+    0x10c4, // Silicon Labs CP210x
+    0x1a86, // WCH CH34x
+    0x067b, // Prolific PL2303
+};
+
+static int
+comparePorts(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+//
+// collect the ports in /dev starting with portprefix which might
+// have a P2 behind them, sorted by name
+// returns the number found
+//
+static int
+findCandidates(char *portprefix, char ***list)
+{
+    DIR *dir;
+    struct dirent *entry;
+    size_t prefixlen = strlen(portprefix);
+    char **ports = NULL;
+    int count = 0, max = 0;
+    char Port[1024];
+    int vid, pid;
+    unsigned k;
+
+    dir = opendir("/dev");
+    if (!dir) {
+        printf("Unable to access /dev\n");
+        promptexit(1);
+    }
+    for(;;) {
+        entry = readdir(dir);
+        if (!entry) break;
+        if (0 != strncmp(entry->d_name, portprefix, prefixlen)) {
+            continue;
+        }
+        snprintf(Port, sizeof(Port), "/dev/%s", entry->d_name);
+        // ports sysfs knows nothing about are probed anyway
+        if (serial_port_usb_info(Port, &vid, &pid, NULL, 0)) {
+            for (k = 0; k < sizeof(p2_usb_vendors)/sizeof(p2_usb_vendors[0]); k++) {
+                if (vid == p2_usb_vendors[k]) break;
+            }
+            if (k == sizeof(p2_usb_vendors)/sizeof(p2_usb_vendors[0])) {
+                if (verbose) printf("skipping %s (USB %04x:%04x)\n", Port, vid, pid);
+                continue;
+            }
+        }
+        if (count == max) {
+            max = max ? 2*max : 16;
+            ports = realloc(ports, max * sizeof(*ports));
+            if (!ports) {
+                printf("Out of memory\n");
+                promptexit(1);
+            }
+        }
+        ports[count++] = duplicate_string(Port);
+    }
+    closedir(dir);
+    if (count > 1) {
+        qsort(ports, count, sizeof(*ports), comparePorts);
+    }
+    *list = ports;
+    return count;
+}
+
+static void
+probeChildStop(int signum)
+{
+    probe_stop = 1;
+}
+
+//
+// probe one port in a child process, so that every port can be
+// probed at once; the child's exit status is the P2 version letter,
+// or 0 if there was none
+//
+static pid_t
+startProbe(char *Port, int baudrate, int retries)
+{
+    pid_t pid;
+    int version = 0;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    // the probe notices SIGTERM between tries, and then puts the
+    // port back the way it was
+    signal(SIGTERM, probeChildStop);
+    if (serial_init(Port, baudrate)) {
+        version = probe_stop ? 0 : probeP2(Port, retries);
+        serial_done();
+    }
+    fflush(stdout);
+    _exit(version);
+}
+
+//
+// probe all the ports at once
+// returns the index of the first port to answer (or -1 if none did),
+// or with list_all prints every P2 found and returns how many there were
+// (and if found is not NULL, sets found[i] for each of them)
+//
+static int
+probeAll(char **ports, int count, int baudrate, int list_all, char *found_p2)
+{
+    pid_t *pids;
+    pid_t pid;
+    int running, i, status, version;
+    int found = -1, listed = 0;
+
+    pids = calloc(count, sizeof(*pids));
+    if (!pids) {
+        printf("Out of memory\n");
+        promptexit(1);
+    }
+    running = 0;
+    for (i = 0; i < count; i++) {
+        pids[i] = startProbe(ports[i], baudrate, 60);
+        if (pids[i] > 0) running++;
+    }
+    while (running > 0) {
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < count && pids[i] != pid; i++)
+            ;
+        if (i == count) continue;
+        pids[i] = 0;
+        running--;
+        version = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+        if (!version) continue;
+        if (list_all) {
+            listP2(ports[i], version);
+            if (found_p2) found_p2[i] = 1;
+            listed++;
+        } else {
+            found = i;
+            break;
+        }
+    }
+    // stop any probes still going, and wait for them to put their
+    // ports back the way they were
+    for (i = 0; i < count; i++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+    while (running > 0) {
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0 && errno != EINTR) break;
+        if (pid > 0) running--;
+    }
+    free(pids);
+    return list_all ? listed : found;
+}
+
+// look for a p2
+// if list_all is set, print every one found and return how many there were
+int findp2(char *portprefix, int baudrate, int list_all)
+{
+    char **ports;
+    int count, i;
+    int found = -1;
+
+    if (verbose) printf("Searching serial ports for a P2\n");
+    count = findCandidates(portprefix, &ports);
+    if (list_all) {
+        found = count ? probeAll(ports, count, baudrate, 1, NULL) : 0;
+    } else if (!do_hwreset) {
+        // nothing to probe for; use the first port which opens
+        for (i = 0; i < count && found < 0; i++) {
+            if (checkp2_and_init(ports[i], baudrate, 60)) {
+                found = i;
+            }
+        }
+    } else if (count) {
+        // the probe ran in a child process, so open the port here
+        // and check it again (which costs one more reset)
+        found = probeAll(ports, count, baudrate, 0, NULL);
+        if (found >= 0 && !checkp2_and_init(ports[found], baudrate, 60)) {
+            found = -1;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        free(ports[i]);
+    }
+    free(ports);
+    if (list_all) {
+        return found;
+    }
+    return found >= 0;
+}
+#endif
+
+//
+// the cache entry "port last <serial> <path>" records the adapter
+// (by USB serial number, or - if it has none) and port on which a P2
+// last answered, so runs without -p can try it before scanning
+//
+static void
+rememberPort(void)
+{
+    char serial[256], value[1400], old[1400];
+
+    if (!p2_port[0] || !do_hwreset) return;
+    if (!serial_usb_serial(serial, sizeof(serial))) {
+        strcpy(serial, "-");
+    }
+    snprintf(value, sizeof(value), "%s %s", serial, p2_port);
+    if (cacheLookup("port", "last", old, sizeof(old)) && !strcmp(old, value)) {
+        return;
+    }
+    cacheStore("port", "last", value);
 }
-static unsigned flag_bits()
+
+//
+// find the port now belonging to the adapter with this serial number
+// (USB ports can be renumbered when devices come and go)
+// returns 1 if found
+//
+static int
+portForSerial(char *portprefix, const char *serial, char *Port, int len)
 {
-    // bit 0: zero out HUB memory
-    // bit 1: binary has been patched with correct frequency
-    return force_zero | (patch_mode << 1);
+#ifdef __MINGW32__
+    return 0;
+#else
+    DIR *dir;
+    struct dirent *entry;
+    size_t prefixlen = strlen(portprefix);
+    char path[1024], sn[256];
+    int vid, pid;
+    int found = 0;
+
+    dir = opendir("/dev");
+    if (!dir) return 0;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (0 != strncmp(entry->d_name, portprefix, prefixlen)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+        if (serial_port_usb_info(path, &vid, &pid, sn, sizeof(sn)) && !strcmp(sn, serial)) {
+            snprintf(Port, len, "%s", path);
+            found = 1;
+        }
+    }
+    closedir(dir);
+    return found;
+#endif
 }
 
-static char *getNextFile(char *fname, char **next_p, int *address_p)
+//
+// try the port recorded by rememberPort
+// returns 1 if there is a P2 on it
+//
+static int
+tryCachedPort(char *portprefix, int baudrate)
 {
-    int address = *address_p;
-    char *next = fname;
+    char value[1400], serial[256], Port[1024], sn[256];
+    int vid, pid, n;
 
-    if (!*fname) {
-        *next_p = NULL;
-        return NULL;
+    if (!cacheLookup("port", "last", value, sizeof(value))
+        || sscanf(value, "%255s %n", serial, &n) != 1 || !value[n])
+    {
+        return 0;
     }
-    if (*fname == '@') {
-        address = strtoul(fname+1, &next, 16);
-        if (*next == '=')
-            next++;
+    snprintf(Port, sizeof(Port), "%s", value + n);
+    if (strcmp(serial, "-") != 0) {
+        // make sure the port still belongs to the same adapter
+        if (!serial_port_usb_info(Port, &vid, &pid, sn, sizeof(sn)) || strcmp(sn, serial) != 0) {
+            if (!portForSerial(portprefix, serial, Port, sizeof(Port))) {
+                if (verbose) printf("Adapter %s from the last run is not present\n", serial);
+                return 0;
+            }
+        }
     }
+    if (verbose) printf("Trying %s from the last run\n", Port);
+    return checkp2_and_init(Port, baudrate, 20);
+}
 
-    // scan ahead to start of next fname
-    while (*fname && *fname != ',') {
-        fname++;
+//
+// put every option kept in a global back to its default (as set where
+// the globals are defined)
+//
+static void
+resetOptions(void)
+{
+    loader_baud = 2000000;
+    fast_baud = 0;
+    clock_mode = -1;
+    user_baud = 115200;
+    clock_freq = 80000000;
+    extra_cycles = 7;
+    load_mode = -1;
+    patch_mode = 0;
+    use_checksum = 1;
+    quiet_mode = 0;
+    enter_rom = NO_ENTER;
+    send_script = NULL;
+    mem_argv_bytes = 0;
+    mem_argv_data = NULL;
+    load_to_flash = false;
+    rom_format = ROM_TXT;
+    verbose = 0;
+    waitAtExit = 0;
+    force_zero = 0;
+    do_hwreset = 1;
+    fifo_size = DEFAULT_FIFO_SIZE;
+    fifo_given = 0;
+    calibrate = 0;
+    chunk_size = 4096;
+    use_compress = 1;
+    delta_mode = 0;
+    scan_ports = 0;
+    resident = 0;
+    gang_mode = 0;
+    batch_list = NULL;
+    batch_dir = "batch-results";
+    batch_timeout = 60;
+    capture_path = NULL;
+    pipe_data = 0;
+    capture_rotate_bytes = 0;
+    capture_rotate_secs = 0;
+    capture_stamps = 0;
+    serve_path = NULL;
+    nserve_ports = 0;
+    himem_bin = NULL;
+    himem_size = 0;
+    himem_is_flash = false;
+    ignoreEof = 0;
+    serial_use_rts_for_reset(0);
+}
+
+//
+// run as a loader server (see server.h) with the command line argc/argv
+// this only returns in the child process which handles a request,
+// with that request's exit status
+//
+static int
+serveRequests(int baudrate, int server_argc, char **server_argv)
+{
+    struct run_request req;
+    char **argv;
+    int argc, n;
+
+    if (nserve_ports == 0) {
+        // serve the board we would otherwise have loaded
+        if (!(do_hwreset && tryCachedPort(PORT_PREFIX, baudrate))
+            && !findp2(PORT_PREFIX, baudrate, 0))
+        {
+            printf("Could not find a P2\n");
+            promptexit(1);
+        }
+        serial_done();
+        serve_ports[nserve_ports++] = duplicate_string(p2_port);
     }
-    if (*fname) {
-        *fname++ = 0;
+    n = server_run(serve_path, nserve_ports, serve_ports, baudrate, &argc, &argv);
+    if (n < 0) {
+        promptexit(1);
     }
-    
-    *address_p = address;
-    *next_p = next;
-    return fname;
+    open_port = serve_ports[n];
+    // the options given to the server are the defaults for each
+    // request; start from scratch, so that nothing else carries over
+    resetOptions();
+    parseOptions(server_argc, server_argv, &req);
+    serve_path = NULL;
+    nserve_ports = 0;
+    parseOptions(argc, argv, &req);
+    return runRequest(&req);
 }
 
-static int verify_chksum(unsigned chksum)
+//
+// -GANG: load the same files into many boards at once, with a process
+// for each board; the files are read once, before the processes are
+// started, and each line a process prints is shown with its port name
+// this only returns in the process for one board, with its port
+//
+#ifdef __MINGW32__
+static char *
+gangLoad(char *fname, int address)
 {
-    unsigned recv_chksum = 0;
-    int num;
-    wait_drain();
-    //msleep(1+fifo_size*10*1000/loader_baud);
-    //num = rx_timeout((uint8_t *)buffer, 3, 400);
-    num = rx_timeout((uint8_t *)buffer, 3, 2000 + fifo_size*10000/loader_baud);
-    if (num != 3) {
-        printf("ERROR: timeout waiting for checksum at end: got %d\n", num);
-        printf("Try increasing the FIFO setting if not large enough for your setup\n");
-        promptexit(1);
+    printf("-GANG is not supported on Windows\n");
+    promptexit(1);
+    return NULL;
+}
+#else
+//
+// the ports given with -p, or else every port where a P2 answers
+//
+static int
+boardPorts(char ***portsp)
+{
+    char **ports;
+    char *found;
+    int count, i, n;
+
+    if (nserve_ports > 0) {
+        *portsp = serve_ports;
+        return nserve_ports;
     }
-    recv_chksum = (buffer[0] - '@') << 4;
-    recv_chksum += (buffer[1] - '@');
-    chksum &= 0xff;
-    if (recv_chksum != (chksum & 0xff)) {
-        printf("ERROR: bad checksum, expected %02x got %02x (chksum characters %c%c%c)\n", chksum, recv_chksum, buffer[0], buffer[1], buffer[2]);
+    count = findCandidates(PORT_PREFIX, &ports);
+    found = calloc(count + 1, 1);
+    if (!found || count == 0 || probeAll(ports, count, loader_baud, 1, found) == 0) {
+        printf("Could not find a P2\n");
         promptexit(1);
     }
-    if (verbose) printf("chksum: %x OK\n", recv_chksum);
-    return 0;
+    for (i = n = 0; i < count; i++) {
+        if (found[i]) ports[n++] = ports[i];
+    }
+    free(found);
+    *portsp = ports;
+    return n;
 }
 
-int loadfile(char *fname, int address)
+struct gang_board {
+    char *port;
+    pid_t pid;
+    int out;                 /* pipe from its stdout and stderr */
+    char line[256];
+    int linelen;
+    int status;
+    unsigned long long start, end;
+};
+
+static void
+gangLine(struct gang_board *b)
 {
-    int num, size;
-    char *next_fname = NULL;
-    int send_size = 0;
+    const char *name = strrchr(b->port, '/');
 
-    if (load_mode == LOAD_SINGLE) {
-        if (address != 0) {
-            printf("ERROR: -SINGLE and -FLASH can only load at address 0\n");
-            promptexit(1);
-        }
-        if (mem_argv_bytes != 0) {
-            printf("ERROR: ARGv is not compatible with -SINGLE and -FLASH\n");
-            promptexit(1);
-        }
-        return loadfilesingle(fname);
-    }
+    name = name ? name + 1 : b->port;
+    printf("[%s] %.*s\n", name, b->linelen, b->line);
+    b->linelen = 0;
+}
 
-    if (verbose) {
-        printf("Loading fast loader...\n");
-    }
-    tx((uint8_t *)"> Prop_Hex 0 0 0 0", 18);
-    txstring((uint8_t *)MainLoader_chip_bin, MainLoader_chip_bin_len);
-    txval(clock_mode);
-    txval(flag_bits());
-    txval(0); // reserved
-    txval(0); // also reserved
-    tx((uint8_t *)"~", 1); // end of download
-    
-    {
-        int retry;
-        // receive checksum, verify it's "@@ "
-        wait_drain();
-        msleep(1+fifo_size*10*1000/loader_baud); // wait for external USB fifo to drain
-        flush_input();
-        msleep(50); // wait for code to start up
-        tx_raw_byte(0x80);
-        wait_drain();
-        msleep(2);
-        for (retry = 0; retry < 5; retry++) {
-            // send autobaud character
-            tx_raw_byte(0x80);
-            wait_drain();
-            msleep(10);
-            num = rx_timeout((uint8_t *)buffer, 3, 200);
-            if (num == 3) break;
-        }
-        if (num != 3) {
-            printf("ERROR: timeout waiting for initial checksum: got %d\n", num);
-            printf("Try increasing the FIFO setting if not large enough for your setup\n");
-            promptexit(1);
-        }
-        // every so often we get a 0 byte first before the checksum; if
-        // we do, throw it away
-        if (buffer[0] == 0 && buffer[2] == '@') {
-            buffer[0] = buffer[2];
-            rx_timeout((uint8_t *)&buffer[2], 1, 100);
-        }
-        if (buffer[0] != '@' || buffer[1] != '@') {
-            printf("ERROR: got incorrect initial chksum: %c%c%c (%02x %02x %02x)\n", buffer[0], buffer[1], buffer[2], buffer[0], buffer[1], buffer[2]);
-            promptexit(1);
+static void
+gangOutput(struct gang_board *b, const char *data, int n)
+{
+    while (n-- > 0) {
+        if (*data == '\n') {
+            gangLine(b);
+        } else if (*data != '\r') {
+            b->line[b->linelen++] = *data;
+            if (b->linelen == sizeof(b->line)) {
+                gangLine(b);
+            }
         }
+        data++;
     }
+}
 
+static char *
+gangLoad(char *fname, int address)
+{
+    struct gang_board *boards;
+    struct pollfd *pfd;
+    char **ports;
+    char buf[512];
+    int count, i, j, fd[2], status;
+    int running, failed = 0;
+    unsigned long long ms;
+    ssize_t r;
 
-    if (load_to_flash && !himem_bin) {
-        // default to flash as himem
-        himem_bin = (uint8_t *)himem_flash_bin;
-        himem_size = himem_flash_bin_len;
-        himem_is_flash = true;
+    count = boardPorts(&ports);
+    if (load_mode != LOAD_SINGLE && prepareFiles(fname, address) != 0) {
+        promptexit(1);
     }
-    // if a himem helper is present, download it to $FC000 and run it
-    if (himem_bin) {
-        int size = downloadData(himem_bin, 0xFC000, himem_size);
-        if (size != himem_size) {
-            printf("Unable to download himem helper\n");
-            promptexit(1);
-        }
-        tx_raw_byte('!'); // tell device to execute this plugin
+
+    boards = calloc(count, sizeof(*boards));
+    pfd = calloc(count, sizeof(*pfd));
+    if (!boards || !pfd) {
+        printf("Out of memory\n");
+        promptexit(1);
     }
-    // we want to be able to insert '\0' characters in fname
-    // in order to break up multiple file names into different strings
-    // so we have to copy it to a duplicate buffer
-    fname = duplicate_string(fname);
-    
-    do {
-        fname = getNextFile(fname, &next_fname, &address);
-        if (!next_fname) {
-            break; /* no more files */
-        }
-        if (*next_fname == '+') {
-            next_fname++;
-            send_size = 1;
-        } else if (address == 0 && (send_size = loadElfSections(next_fname)) >= 0) {
-            if (verbose) printf("Loaded %d bytes from ELF file %s\n", send_size, next_fname);
+    printf("Loading %d boards\n", count);
+    for (i = 0; i < count; i++) {
+        boards[i].port = ports[i];
+        boards[i].out = -1;
+        boards[i].status = 1;
+        boards[i].start = elapsedms();
+        if (pipe(fd) != 0) {
+            printf("Unable to create pipe: %s\n", strerror(errno));
             continue;
-        } else {
-            send_size = 0;
         }
-        if (send_size) {
-            // prepend the 4 byte size to the data
-            size = readBinaryFile(next_fname, (uint8_t*)&size, 4);
-        } else {
-            size = readBinaryFile(next_fname, NULL, 0);
+        fflush(stdout);
+        boards[i].pid = fork();
+        if (boards[i].pid == 0) {
+            close(fd[0]);
+            for (j = 0; j < i; j++) {
+                if (boards[j].out >= 0) close(boards[j].out);
+            }
+            dup2(fd[1], 1);
+            dup2(fd[1], 2);
+            close(fd[1]);
+            setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+            waitAtExit = 0;
+            gang_board = 1;
+            return ports[i];
         }
-        if (size < 0)
-        {
-            printf("Could not open %s\n", next_fname);
-            return 1;
+        close(fd[1]);
+        if (boards[i].pid < 0) {
+            printf("Unable to start process for %s\n", ports[i]);
+            close(fd[0]);
+            continue;
         }
+        boards[i].out = fd[0];
+    }
 
-#if 0        
-        /* patch the file data if necessary */
-        /* now happens in downloadData */
-        if (patch_mode) {
-            uint8_t *buffer = (send_size) ? g_filedata+4 : g_filedata;
-            patch_mode = 0;
-            if (g_filesize >= 0x24) {
-                memcpy(&buffer[0x14], &clock_freq, 4);
-                memcpy(&buffer[0x18], &clock_mode, 4);
-                memcpy(&buffer[0x1c], &user_baud, 4);
+    for (;;) {
+        running = 0;
+        for (i = 0; i < count; i++) {
+            pfd[i].fd = boards[i].out;
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+            if (boards[i].out >= 0) running++;
+        }
+        if (!running) break;
+        if (poll(pfd, count, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            if (boards[i].out < 0 || !pfd[i].revents) continue;
+            r = read(boards[i].out, buf, sizeof(buf));
+            if (r > 0) {
+                gangOutput(&boards[i], buf, r);
+                continue;
             }
+            // the board's process has finished
+            if (boards[i].linelen) gangLine(&boards[i]);
+            close(boards[i].out);
+            boards[i].out = -1;
+            while (waitpid(boards[i].pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            boards[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+            boards[i].end = elapsedms();
         }
-#endif        
-        /* now send the file data from g_filedata */
-        if (verbose) printf("Loading %s - %d bytes\n", next_fname, size);
-        num = downloadData(g_filedata, address, g_filesize);
+        fflush(stdout);
+    }
 
-        if (num < 0) {
-            printf("Error downloading %s\n", next_fname);
-            promptexit(1);
-        }
-        wait_drain();
-    } while (*fname);
+    printf("\n");
+    for (i = 0; i < count; i++) {
+        ms = boards[i].end ? boards[i].end - boards[i].start : 0;
+        printf("%-24s %s  %llu.%llu s\n", boards[i].port, boards[i].status ? "FAIL" : "PASS",
+               ms / 1000, (ms % 1000) / 100);
+        if (boards[i].status) failed++;
+    }
+    printf("%d of %d boards passed\n", count - failed, count);
+    promptexit(failed ? 1 : 0);
+    return NULL;
+}
+#endif
 
-    if (load_to_flash) {
-        uint8_t *bootloader;
-        uint32_t *ptr32;
+//
+// -BATCH: run each test program named in the list file on whichever
+// board is free first, as with -t -q; a test passes if it is loaded and
+// then exits with status 0 within the time allowed. The console output
+// of each test goes to a log in batch_dir, and a line for each test is
+// added to batch_dir/summary.tsv
+// this only returns in the process for one test, with its port
+//
+#ifdef __MINGW32__
+static char *
+batchRun(char **fnamep)
+{
+    printf("-BATCH is not supported on Windows\n");
+    promptexit(1);
+    return NULL;
+}
+#else
+struct batch_test {
+    char *file;
+    char *log;
+    const char *status;      /* NULL while it runs */
+    int code;
+    unsigned long long start, end;
+};
 
-        /* fix up the flash bootloader ("stub") so that it knows how
-           much to load and its checksum */
-        bootloader = calloc(1, 1024);
-        if (flash_stub_bin_len > 1024) {
-            printf("Internal error, flash stub is too big to fit\n");
-            return -1;
-        }
-        memcpy(bootloader, flash_stub_bin, flash_stub_bin_len);
+struct batch_board {
+    char *port;
+    pid_t pid;               /* 0 when the board is free */
+    int test;
+    int loaded;              /* pipe from the test's process */
+};
 
-        g_highest_hub_addr = (g_highest_hub_addr + 3) & ~3;
-        ptr32 = (uint32_t *)bootloader;
-        ptr32[2] = g_highest_hub_addr;
+static char **
+readBatchList(const char *name, int *countp)
+{
+    FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+    char line[1024];
+    char **files = NULL;
+    int count = 0, max = 0;
+    char *s, *e;
 
-        /* now calculate the checksum of the bootloader itself */
-        uint32_t boot_sum = 0;
-        for (int n = 0; n < 1024/4; n++) {
-            boot_sum += ptr32[n];
-        }
-        /* adjust so it will become the magic value "Prop" */
-        ptr32[1] = BOOT_MAGIC - boot_sum;
-        if (verbose) {
-            printf("highest hub address: 0x%x chksum: 0x%x\n", ptr32[2], ptr32[1]);
+    if (!f) {
+        printf("Unable to open %s: %s\n", name, strerror(errno));
+        promptexit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        for (s = line; isspace((unsigned char)*s); s++)
+            ;
+        e = s + strlen(s);
+        while (e > s && isspace((unsigned char)e[-1])) {
+            *--e = 0;
         }
-        /* load boot stub to start of flash memory  */
-        downloadData(bootloader, 0x80000000, 1024);
-        wait_drain();
-        if (verbose) printf("sending F 0x%08x to device\n", g_highest_hub_addr);
-        tx_raw_byte('F'); /* says to flash HUB and then start */
-        tx_raw_long(g_highest_hub_addr);
-    } else {
-        if (mem_argv_bytes) {
-            /* send ARGv info to $FC000 */
-            if (verbose) printf("sending %d arg bytes\n", mem_argv_bytes);
-            downloadData((uint8_t *)mem_argv_data, ARGV_ADDR, mem_argv_bytes);
+        if (!*s || *s == '#') continue;
+        if (count == max) {
+            max = max ? 2 * max : 64;
+            files = realloc(files, max * sizeof(*files));
+            if (!files) {
+                printf("Out of memory\n");
+                promptexit(1);
+            }
         }
-        tx_raw_byte('-'); /* finished with programming */
+        files[count++] = duplicate_string(s);
     }
-
-    wait_drain();
-    msleep(100);
-    return 0;
+    if (f != stdin) fclose(f);
+    *countp = count;
+    return files;
 }
 
-// check for a p2 on a specific port
+static void
+batchResult(FILE *summary, struct batch_test *t, const char *port)
+{
+    unsigned long long ms = t->end - t->start;
 
-static int
-checkp2_and_init(char *Port, int baudrate, int retries)
+    printf("%-7s %4llu.%llu s  %-16s %s\n", t->status, ms / 1000, (ms % 1000) / 100,
+           port, t->file);
+    fprintf(summary, "%s\t%s\t%d\t%llu.%03llu\t%s\t%s\n", t->file, t->status, t->code,
+            ms / 1000, ms % 1000, port, t->log);
+    fflush(stdout);
+    fflush(summary);
+}
+
+static char *
+batchRun(char **fnamep)
 {
-    char buffer[101];
-    int num;
-    int i;
-    
-    if (!serial_init(Port, baudrate)) {
-        return 0;
-    }
+    struct batch_test *tests;
+    struct batch_board *boards;
+    char **ports, **files;
+    char name[1100];
+    const char *base;
+    FILE *summary;
+    int ntests, nboards, next = 0, running = 0, failed = 0;
+    int i, j, t, logfd, fd[2], in[2], status;
+    unsigned long long now;
+    char c;
+    pid_t pid;
 
-    if (!do_hwreset) {
-        return 1;
+    files = readBatchList(batch_list, &ntests);
+    nboards = boardPorts(&ports);
+    if (mkdir(batch_dir, 0777) != 0 && errno != EEXIST) {
+        printf("Unable to create %s: %s\n", batch_dir, strerror(errno));
+        promptexit(1);
     }
+    snprintf(name, sizeof(name), "%s/summary.tsv", batch_dir);
+    summary = fopen(name, "w");
+    tests = calloc(ntests + 1, sizeof(*tests));
+    boards = calloc(nboards, sizeof(*boards));
+    if (!summary || !tests || !boards) {
+        printf("Unable to write %s\n", name);
+        promptexit(1);
+    }
+    fprintf(summary, "test\tstatus\texit\tseconds\tport\tlog\n");
+    fflush(summary);
+    printf("Running %d tests on %d boards\n", ntests, nboards);
 
-    // reset and look for a P2
-    hwreset();
-    msleep(20); // wait for P2 to become active
-    if (verbose) printf("trying %s...\n", Port);
-
-    for (i = 0; i < retries; i++) {
-        flush_input();
-        tx((uint8_t *)"> Prop_Chk 0 0 0 0  ", 20);
-        wait_drain();
-        msleep(50+20*10*1000/loader_baud); // wait at least for 20 chars to empty through any fifo at the loader baud rate 
-        num = rx_timeout((uint8_t *)buffer, 20, 10+20*10*1000/loader_baud); // read 20 characters 
-        if (num >= 0) buffer[num] = 0;
-        else {
-            buffer[0] = 0;
-            if (0 && verbose) printf("  timeout\n");
-        }
-        if (!strncmp(buffer, "\r\nProp_Ver ", 11))
-        {
-            if (verbose) printf("P2 version %c found on serial port %s\n", buffer[11], Port);
-            if (load_mode == -1)
-            {
-                if (buffer[11] == 'B')
-                {
-                    printf("ERROR: Detected FPGA, but this version of loadp2 does not support FPGA!\n");
-                    promptexit(1);
+    for (;;) {
+        // start the next tests on any free boards
+        for (i = 0; i < nboards && next < ntests; i++) {
+            if (boards[i].pid) continue;
+            t = next++;
+            tests[t].file = files[t];
+            base = strrchr(files[t], '/');
+            snprintf(name, sizeof(name), "%s/%04d-%s.log", batch_dir, t + 1,
+                     base ? base + 1 : files[t]);
+            tests[t].log = duplicate_string(name);
+            tests[t].start = elapsedms();
+            logfd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (logfd < 0 || pipe(fd) != 0) {
+                printf("Unable to create %s: %s\n", name, strerror(errno));
+                if (logfd >= 0) close(logfd);
+                tests[t].status = "ERROR";
+                tests[t].end = tests[t].start;
+                batchResult(summary, &tests[t], ports[i]);
+                failed++;
+                i--;   // the board is still free
+                continue;
+            }
+            fflush(stdout);
+            pid = fork();
+            if (pid == 0) {
+                close(fd[0]);
+                for (j = 0; j < nboards; j++) {
+                    if (boards[j].pid) close(boards[j].loaded);
                 }
-                else if (buffer[11] == 'A' || buffer[11] == 'G')
-                {
-                    load_mode = LOAD_CHIP;
-                    if (verbose) printf("Setting load mode to CHIP\n");
+                // the test's output goes to its log; its input never
+                // ends, and never has anything in it
+                dup2(logfd, 1);
+                dup2(logfd, 2);
+                close(logfd);
+                if (pipe(in) == 0) {
+                    dup2(in[0], 0);
+                    close(in[0]);
                 }
-                else
+                batch_fd = fd[1];
+                waitAtExit = 0;
+                *fnamep = files[t];
+                return ports[i];
+            }
+            close(fd[1]);
+            close(logfd);
+            if (pid < 0) {
+                printf("Unable to start process: %s\n", strerror(errno));
+                close(fd[0]);
+                promptexit(1);
+            }
+            boards[i].port = ports[i];
+            boards[i].pid = pid;
+            boards[i].test = t;
+            boards[i].loaded = fd[0];
+            running++;
+        }
+        if (!running) break;
+
+        pid = waitpid(-1, &status, WNOHANG);
+        now = elapsedms();
+        if (pid <= 0) {
+            for (i = 0; i < nboards; i++) {
+                t = boards[i].test;
+                if (boards[i].pid && !tests[t].status
+                    && now - tests[t].start > batch_timeout * 1000ULL)
                 {
-                    printf("Warning: Unknown version %c, assuming CHIP\n", buffer[11]);
-                    load_mode = LOAD_CHIP;
+                    kill(boards[i].pid, SIGKILL);
+                    tests[t].status = "TIMEOUT";
                 }
             }
-            return 1;
+            msleep(10);
+            continue;
+        }
+        for (i = 0; i < nboards && boards[i].pid != pid; i++)
+            ;
+        if (i == nboards) continue;
+        t = boards[i].test;
+        // the test's process writes to the pipe once the test is loaded
+        c = 0;
+        if (read(boards[i].loaded, &c, 1) != 1) c = 0;
+        close(boards[i].loaded);
+        boards[i].pid = 0;
+        running--;
+        tests[t].end = now;
+        if (WIFEXITED(status)) {
+            tests[t].code = WEXITSTATUS(status);
+        } else {
+            tests[t].code = -1;
         }
+        if (!tests[t].status) {
+            if (c != 'L' || tests[t].code < 0) {
+                tests[t].status = "ERROR";
+            } else {
+                tests[t].status = tests[t].code ? "FAIL" : "PASS";
+            }
+        }
+        if (strcmp(tests[t].status, "PASS") != 0) failed++;
+        batchResult(summary, &tests[t], ports[i]);
     }
-    // if we get here we failed to find a chip
-    serial_done();
-    return 0;
+    fclose(summary);
+    printf("%d of %d tests passed; results are in %s/summary.tsv\n",
+           ntests - failed, ntests, batch_dir);
+    promptexit(failed ? 1 : 0);
+    return NULL;
 }
-    
-// look for a p2
-int findp2(char *portprefix, int baudrate)
+#endif
+
+//
+// -CAPTURE: write everything the board sends to a file, exactly as it
+// arrives (no PST translation, no exit or 9P escapes), until we are
+// interrupted. With -ROTATE or -ROTATESECS, numbered files are written
+// instead, starting a new one when the current one reaches that size
+// or age. With -STAMP, each file gets a .idx file with a line for each
+// piece of data read: its offset in the file, the host time it arrived
+// (in ms from the start of the capture), and its length
+//
+#define CAPTURE_CHUNK    65536
+#define CAPTURE_BUF_SIZE (1024*1024)
+
+static volatile sig_atomic_t capture_stop = 0;
+
+static void
+captureSignal(int sig)
 {
-    char Port[1024];
-#ifdef INTEGER_PREFIXES    
-    int i;
-    char targetPath[1024];
-    
-    if (verbose) printf("Searching serial ports for a P2\n");
-    for (i = 1; i < 255; i++)
-    {
-        sprintf(Port, "%s%d", portprefix, i);
-        if (0==QueryDosDevice(Port, targetPath, sizeof(targetPath)))
-            continue;
-        if (checkp2_and_init(Port, baudrate, 50))
-        {
-            return 1;
+    capture_stop = 1;
+}
+
+struct capture_file {
+    FILE *f;
+    FILE *idx;
+    long long bytes;
+    unsigned long long opened;
+    int seq;
+};
+
+static int
+captureOpen(struct capture_file *cf, long long start_time)
+{
+    char name[1100];
+
+    if (capture_rotate_bytes || capture_rotate_secs) {
+        snprintf(name, sizeof(name), "%s.%04d", capture_path, cf->seq);
+    } else {
+        snprintf(name, sizeof(name), "%s", capture_path);
+    }
+    cf->seq++;
+    cf->f = fopen(name, "wb");
+    if (!cf->f) {
+        printf("Unable to create %s: %s\n", name, strerror(errno));
+        return 0;
+    }
+    setvbuf(cf->f, NULL, _IOFBF, CAPTURE_BUF_SIZE);
+    if (capture_stamps) {
+        strcat(name, ".idx");
+        cf->idx = fopen(name, "w");
+        if (!cf->idx) {
+            printf("Unable to create %s: %s\n", name, strerror(errno));
+            fclose(cf->f);
+            cf->f = NULL;
+            return 0;
         }
+        fprintf(cf->idx, "# offset ms bytes; ms counts from Unix time %lld\n", start_time);
     }
-#else
-    DIR *dir;
-    struct dirent *entry;
-    size_t prefixlen = strlen(portprefix);
+    cf->bytes = 0;
+    cf->opened = elapsedms();
+    return 1;
+}
 
-    dir = opendir("/dev");
-    if (!dir) {
-        printf("Unable to access /dev\n");
-        promptexit(1);
+static int
+captureClose(struct capture_file *cf)
+{
+    int ok = 1;
+
+    if (cf->f && fclose(cf->f) != 0) ok = 0;
+    if (cf->idx && fclose(cf->idx) != 0) ok = 0;
+    cf->f = cf->idx = NULL;
+    return ok;
+}
+
+static int
+captureMode(void)
+{
+    static uint8_t buf[CAPTURE_CHUNK];
+    struct capture_file cf;
+    long long start_time = (long long)time(NULL);
+    unsigned long long start, now, sec_start;
+    long long total = 0, sec_bytes = 0, peak = 0, rate;
+    unsigned long over0, over1;
+    int have_overruns;
+    int n, off, k, ok = 1;
+    double secs;
+
+    memset(&cf, 0, sizeof(cf));
+    if (!captureOpen(&cf, start_time)) {
+        return 1;
     }
-    for(;;) {
-        entry = readdir(dir);
-        if (!entry) break;
-        if (0 != strncmp(entry->d_name, portprefix, prefixlen)) {
-            continue;
+    capture_stop = 0;
+    signal(SIGINT, captureSignal);
+    signal(SIGTERM, captureSignal);
+    have_overruns = serial_overruns(&over0) == 0;
+    if (!quiet_mode) {
+        printf("( Capturing to %s.  Press Ctrl-C to stop. )\n", capture_path);
+        fflush(stdout);
+    }
+    start = sec_start = elapsedms();
+    while (!capture_stop && ok) {
+        n = rx_timeout(buf, sizeof(buf), 100);
+        if (n == SERIAL_ERROR) {
+            printf("Error reading the serial port; the device may have gone away\n");
+            ok = 0;
+            break;
         }
-        strcpy(Port, "/dev/");
-        strcat(Port, entry->d_name);
-        if (checkp2_and_init(Port, baudrate, 60)) {
-            closedir(dir);
-            return 1;
+        now = elapsedms();
+        for (off = 0; n > 0 && off < n && ok; off += k) {
+            k = n - off;
+            if (capture_rotate_bytes && cf.bytes + k > capture_rotate_bytes) {
+                k = (int)(capture_rotate_bytes - cf.bytes);
+            }
+            if (cf.idx) {
+                fprintf(cf.idx, "%lld %llu %d\n", cf.bytes, now - start, k);
+            }
+            if (fwrite(buf + off, 1, k, cf.f) != (size_t)k) {
+                printf("Error writing capture file: %s\n", strerror(errno));
+                ok = 0;
+            }
+            cf.bytes += k;
+            if (capture_rotate_bytes && cf.bytes >= capture_rotate_bytes) {
+                ok = captureClose(&cf) && captureOpen(&cf, start_time);
+            }
+        }
+        if (n > 0) {
+            total += n;
+            sec_bytes += n;
+        }
+        if (ok && capture_rotate_secs && cf.bytes > 0
+            && now - cf.opened >= capture_rotate_secs * 1000ULL)
+        {
+            ok = captureClose(&cf) && captureOpen(&cf, start_time);
+        }
+        if (now - sec_start >= 1000) {
+            rate = sec_bytes * 1000 / (long long)(now - sec_start);
+            if (rate > peak) peak = rate;
+            sec_start = now;
+            sec_bytes = 0;
         }
     }
-    closedir(dir);
-#endif
-    return 0;
+    if (!captureClose(&cf)) {
+        printf("Error writing capture file: %s\n", strerror(errno));
+        ok = 0;
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    secs = (elapsedms() - start) / 1000.0;
+    if (peak == 0 && secs > 0) peak = (long long)(total / secs);
+    printf("Captured %lld bytes in %d file%s over %.1f s: %.0f bytes/s on average, %lld bytes/s at most\n",
+           total, cf.seq, cf.seq == 1 ? "" : "s", secs, secs > 0 ? total / secs : 0.0, peak);
+    if (have_overruns && serial_overruns(&over1) == 0) {
+        printf("Serial overruns: %lu\n", over1 - over0);
+    } else {
+        printf("Serial overruns: not reported by this port\n");
+    }
+    return ok ? 0 : 1;
 }
 
 int atox(char *ptr)
@@ -1088,14 +3416,41 @@ int get_clock_mode(int sysfreq)
 
 int main(int argc, char **argv)
 {
+    struct run_request req;
     int i;
-    int runterm = 0;
-    int pstmode = 0;
-    char *fname = 0;
-    char *port = 0;
-    int address = 0;
-    char *u9root = 0;
-    
+
+    // with -CLIENT, a loadp2 -SERVE does all the work
+    for (i = 1; i < argc && !(argv[i][0] == '-' && argv[i][1] == 'a'); i++)
+    {
+        if (!strcmp(argv[i], "-CLIENT"))
+        {
+            char *path;
+            if (i + 1 >= argc)
+                Usage("Missing socket for -CLIENT");
+            path = argv[i+1];
+            // pass on everything else (including the NULL at the end)
+            memmove(&argv[i], &argv[i+2], (argc - i - 1) * sizeof(*argv));
+            argc -= 2;
+            exit(client_run(path, argc - 1, argv + 1));
+        }
+    }
+
+    parseOptions(argc, argv, &req);
+    if (serve_path) {
+        return serveRequests(loader_baud, argc, argv);
+    }
+    return runRequest(&req);
+}
+
+//
+// read the command line into req and the option globals
+//
+static void
+parseOptions(int argc, char **argv, struct run_request *req)
+{
+    int i;
+
+    memset(req, 0, sizeof(*req));
     // Parse the command-line parameters
     for (i = 1; i < argc; i++)
     {
@@ -1104,14 +3459,16 @@ int main(int argc, char **argv)
             if (argv[i][1] == 'p')
             {
                 if(argv[i][2])
-                    port = &argv[i][2];
+                    req->port = &argv[i][2];
                 else if (++i < argc)
-                    port = argv[i];
+                    req->port = argv[i];
                 else {
                     Usage("Missing parameter for -p");
                 }
+                if (nserve_ports < MAX_SERVE_PORTS)
+                    serve_ports[nserve_ports++] = req->port;
 #ifdef MACOSX
-                if (strstr(port, "tty.")) {
+                if (strstr(req->port, "tty.")) {
                     printf("WARNING: using /dev/tty.* will probably not work on the Mac; try /dev/cu.* instead\n");
                 }
 #endif                
@@ -1171,12 +3528,83 @@ int main(int argc, char **argv)
                 else
                     Usage("Missing frequency for -f");
             }
+            else if (!strcmp(argv[i], "-FASTBAUD"))
+            {
+                if (++i < argc)
+                    fast_baud = atoi(argv[i]);
+                else
+                    Usage("Missing baud rate for -FASTBAUD");
+            }
+            else if (!strcmp(argv[i], "-CHUNK"))
+            {
+                if (++i < argc)
+                    chunk_size = atoi(argv[i]);
+                else
+                    Usage("Missing byte count for -CHUNK");
+                if (chunk_size < 1024 || chunk_size > 16384 || (chunk_size & (chunk_size-1)))
+                    Usage("-CHUNK must be a power of 2 from 1024 to 16384");
+            }
+            else if (!strcmp(argv[i], "-NOCOMPRESS"))
+            {
+                use_compress = 0;
+            }
+            else if (!strcmp(argv[i], "-DELTA"))
+            {
+                delta_mode = 1;
+            }
+            else if (!strcmp(argv[i], "-SERVE"))
+            {
+                if (++i < argc)
+                    serve_path = argv[i];
+                else
+                    Usage("Missing socket for -SERVE");
+            }
+            else if (!strcmp(argv[i], "-GANG"))
+            {
+                gang_mode = 1;
+            }
+            else if (!strcmp(argv[i], "-BATCH"))
+            {
+                if (++i < argc)
+                    batch_list = argv[i];
+                else
+                    Usage("Missing list file for -BATCH");
+            }
+            else if (!strcmp(argv[i], "-BATCHDIR"))
+            {
+                if (++i < argc)
+                    batch_dir = argv[i];
+                else
+                    Usage("Missing directory for -BATCHDIR");
+            }
+            else if (!strcmp(argv[i], "-TIMEOUT"))
+            {
+                if (++i < argc)
+                    batch_timeout = atoi(argv[i]);
+                else
+                    Usage("Missing seconds for -TIMEOUT");
+                if (batch_timeout <= 0)
+                    Usage("-TIMEOUT must be at least 1 second");
+            }
+            else if (!strcmp(argv[i], "-RESIDENT"))
+            {
+                resident = 1;
+            }
+            else if (!strcmp(argv[i], "-SCAN"))
+            {
+                scan_ports = 1;
+            }
+            else if (!strcmp(argv[i], "-CALIBRATE"))
+            {
+                calibrate = 1;
+            }
             else if (!strcmp(argv[i], "-FIFO"))
             {
                 if (++i < argc)
                     fifo_size = atoi(argv[i]);
                 else
                     Usage("Missing byte count for -FIFO");
+                fifo_given = 1;
             }
             else if (argv[i][1] == 'k')
             {
@@ -1202,16 +3630,16 @@ int main(int argc, char **argv)
             else if (argv[i][1] == 's')
             {
                 if(argv[i][2])
-                    address = atox(&argv[i][2]);
+                    req->address = atox(&argv[i][2]);
                 else if (++i < argc)
-                    address = atox(argv[i]);
+                    req->address = atox(argv[i]);
                 else
                     Usage("Missing start address for -s");
             }
             else if (argv[i][1] == 't')
-                runterm = 1;
+                req->runterm = 1;
             else if (argv[i][1] == 'T') {
-                runterm = pstmode = 1;
+                req->runterm = req->pstmode = 1;
             }
             else if (argv[i][1] == 'x') {
                 char *monitor = NULL;
@@ -1228,7 +3656,7 @@ int main(int argc, char **argv)
                         enter_rom = ENTER_DEBUG;
                     } else if (!strcmp(monitor, "TERM")) {
                         do_hwreset = 0;
-                        runterm = 1;
+                        req->runterm = 1;
                     } else {
                         Usage("Unknown monitor option after -x");
                     }
@@ -1245,9 +3673,9 @@ int main(int argc, char **argv)
             else if (argv[i][1] == '9')
             {
                 if(argv[i][2])
-                    u9root = &argv[i][2];
+                    req->u9root = &argv[i][2];
                 else if (++i < argc)
-                    u9root = &argv[i][0];
+                    req->u9root = &argv[i][0];
                 else
                     Usage("Missing directory option for -9");
             }
@@ -1278,8 +3706,50 @@ int main(int argc, char **argv)
                 serial_use_rts_for_reset(0);
             else if (!strcmp(argv[i], "-RTS"))
                 serial_use_rts_for_reset(1);
+            else if (!strcmp(argv[i], "-CAPTURE"))
+            {
+                if (++i < argc)
+                    capture_path = argv[i];
+                else
+                    Usage("Missing file name for -CAPTURE");
+            }
+            else if (!strcmp(argv[i], "-ROTATE"))
+            {
+                char *end;
+                if (++i < argc)
+                    capture_rotate_bytes = strtoll(argv[i], &end, 0);
+                else
+                    Usage("Missing size for -ROTATE");
+                if (*end == 'k' || *end == 'K')
+                    capture_rotate_bytes *= 1024;
+                else if (*end == 'm' || *end == 'M')
+                    capture_rotate_bytes *= 1024*1024;
+                else if (*end == 'g' || *end == 'G')
+                    capture_rotate_bytes *= 1024*1024*1024LL;
+                if (capture_rotate_bytes <= 0)
+                    Usage("-ROTATE needs a size in bytes (k, M or G may follow)");
+            }
+            else if (!strcmp(argv[i], "-ROTATESECS"))
+            {
+                if (++i < argc)
+                    capture_rotate_secs = atoi(argv[i]);
+                else
+                    Usage("Missing seconds for -ROTATESECS");
+                if (capture_rotate_secs <= 0)
+                    Usage("-ROTATESECS must be at least 1 second");
+            }
+            else if (!strcmp(argv[i], "-STAMP"))
+            {
+                capture_stamps = 1;
+            }
+            else if (!strcmp(argv[i], "-PIPE"))
+            {
+                pipe_data = 1;
+            }
             else if (!strcmp(argv[i], "-NOEOF"))
                 ignoreEof = 1;
+            else if (!strcmp(argv[i], "-HEX"))
+                rom_format = ROM_HEX;
             else
             {
                 printf("Invalid option %s\n", argv[i]);
@@ -1288,8 +3758,8 @@ int main(int argc, char **argv)
         }
         else
         {
-            if (fname) Usage("too many files specified on command line");
-            fname = argv[i];
+            if (req->fname) Usage("too many files specified on command line");
+            req->fname = argv[i];
         }
     }
 
@@ -1324,12 +3794,44 @@ int main(int argc, char **argv)
         // do not have to 0 terminate, we used calloc above
     }
     if (enter_rom) {
-        if (fname) {
+        if (req->fname) {
             printf("Entering ROM is incompatible with downloading a file\n");
             Usage(NULL);
         }
     }
-    if (!fname && !runterm && !enter_rom) {
+}
+
+//
+// carry out what the command line asked for
+//
+static int
+runRequest(struct run_request *req)
+{
+    if (scan_ports) {
+        int found = findp2(PORT_PREFIX, loader_baud, 1);
+        if (!found) printf("Could not find a P2\n");
+        promptexit(found ? 0 : 1);
+    }
+    if (batch_list) {
+        if (req->fname || gang_mode || enter_rom) {
+            Usage("-BATCH takes the programs from its list, and cannot be used with -GANG or -x");
+        }
+        // every test is run as with -t -q
+        req->runterm = quiet_mode = 1;
+    }
+    if (capture_path && (req->runterm || enter_rom || req->u9root || gang_mode || batch_list)) {
+        Usage("-CAPTURE cannot be used with -t, -T, -x, -9, -GANG or -BATCH");
+    }
+    if (pipe_data && (req->runterm || enter_rom || req->u9root || gang_mode || batch_list || capture_path)) {
+        Usage("-PIPE cannot be used with -t, -T, -x, -9, -GANG, -BATCH or -CAPTURE");
+    }
+#ifdef __MINGW32__
+    if (pipe_data) {
+        printf("-PIPE is not supported on Windows\n");
+        promptexit(1);
+    }
+#endif
+    if (!req->fname && !req->runterm && !enter_rom && !capture_path && !pipe_data) {
         Usage("Must specify a file name or -t or -x");
     }
     // Determine the user baud rate
@@ -1339,25 +3841,49 @@ int main(int argc, char **argv)
         if (verbose) printf("Setting user_baud to %d\n", user_baud);
     }
 
+    if (batch_list)
+    {
+        // from here on we are running just one of the tests
+        req->port = batchRun(&req->fname);
+    }
+
     // Initialize the loader baud rate
     // on some platforms the user and loader baud rates must match
     // this does not matter if we are not starting a terminal
-    if (runterm || enter_rom || send_script)
+    if (req->runterm || enter_rom || send_script || capture_path || pipe_data)
     {
         int new_loader_baud = get_loader_baud(user_baud, loader_baud);
         if (new_loader_baud != loader_baud) {
             printf("Platform required loader baud to be changed to %d\n", new_loader_baud);
             loader_baud = new_loader_baud;
         }
-        if (!fname) {
+        if (!req->fname) {
             loader_baud = user_baud;
         }
     }
     
+    if (gang_mode)
+    {
+        if (!req->fname || req->runterm || enter_rom) {
+            Usage("-GANG needs a file to load, and cannot be used with -t or -x");
+        }
+        // from here on we are loading just one of the boards
+        req->port = gangLoad(req->fname, req->address);
+    }
+
     // Determine the P2 serial port
-    if (!port)
+    if (open_port)
+    {
+        if (!checkp2_and_init(open_port, loader_baud, 100))
+        {
+            printf("Could not find a P2 on port %s\n", open_port);
+            promptexit(1);
+        }
+    }
+    else if (!req->port)
     {
-        if (!findp2(PORT_PREFIX, loader_baud))
+        if (!(do_hwreset && tryCachedPort(PORT_PREFIX, loader_baud))
+            && !findp2(PORT_PREFIX, loader_baud, 0))
         {
             printf("Could not find a P2\n");
             promptexit(1);
@@ -1365,14 +3891,25 @@ int main(int argc, char **argv)
     }
     else
     {
-        if (!checkp2_and_init(port, loader_baud, 100))
+        if (!checkp2_and_init(req->port, loader_baud, 100))
         {
-            printf("Could not find a P2 on port %s\n", port);
+            printf("Could not find a P2 on port %s\n", req->port);
             promptexit(1);
         }
     }
-    if (fname)
+    // with -GANG or -BATCH there is no one port to remember
+    if (!gang_board && batch_fd < 0) {
+        rememberPort();
+    }
+    progress("found P2");
+    if (req->fname)
     {
+        if (load_mode == -1 && resident && !do_hwreset)
+        {
+            // there was no Prop_Chk, but a resident loader means CHIP
+            load_mode = LOAD_CHIP;
+            if (verbose) printf("Setting load mode to CHIP\n");
+        }
         if (load_mode == LOAD_CHIP)
         {
             if (clock_mode == -1)
@@ -1387,20 +3924,21 @@ int main(int argc, char **argv)
             if (verbose) printf("Setting load mode to SINGLE\n");
         }
 
-        if (loadfile(fname, address))
+        if (loadfile(req->fname, req->address))
         {
             serial_done();
             promptexit(1);
         }
     }
 
-    if (u9root) {
-        runterm = 3;
-        u9fs_init(u9root);
+    if (req->u9root) {
+        req->runterm = 3;
+        u9fs_init(req->u9root);
     }
-    if (runterm || enter_rom || send_script)
+    if (req->runterm || enter_rom || send_script || capture_path || pipe_data)
     {
         serial_baud(user_baud);
+        report_baud("User", user_baud);
         switch(enter_rom) {
         case ENTER_DEBUG:
             tx((uint8_t *)"> \004", 3);
@@ -1414,11 +3952,28 @@ int main(int argc, char **argv)
         if (send_script) {
             RunScript(send_script);
         }
-        if (runterm) {
+        if (capture_path) {
+            int r = captureMode();
+            waitAtExit = 0;
+            serial_done();
+            promptexit(r);
+        }
+        if (pipe_data) {
+            pipe_mode();
+            waitAtExit = 0;
+        }
+        if (req->runterm) {
             if (!quiet_mode) {
                 printf("( Entering terminal mode.  Press Ctrl-] or Ctrl-Z to exit. )\n");
             }
-            terminal_mode(runterm, pstmode);
+#ifndef __MINGW32__
+            if (batch_fd >= 0) {
+                // tell the batch runner the test is running
+                write(batch_fd, "L", 1);
+                close(batch_fd);
+            }
+#endif
+            terminal_mode(req->runterm, req->pstmode);
             if (!quiet_mode) {
                 waitAtExit = 0; // no need to wait, user explicitly quit
             }
@@ -1427,6 +3982,7 @@ int main(int argc, char **argv)
 
     serial_done();
     promptexit(0);
+    return 0;
 }
 
 //
@@ -1495,8 +4051,9 @@ static int SendFile(char *filename, int binary)
             tx_raw_byte(c);
         }
         count++;
-        if (count >= scriptVarPauseAfter) {
+        if (scriptVarPauseAfter && count >= scriptVarPauseAfter) {
             // pause periodically for the other end to keep up
+            tx_flush();
             msleep(1);
             count = 0;
         }
@@ -1519,30 +4076,14 @@ scriptBinfile(char *name)
 
 static int scriptRecv(char *string)
 {
-    int num;
-    char *here = string;
-    unsigned long long start = elapsedms();
-    unsigned long long now;
-    
-    for(;;) {
-        now = elapsedms();
-        if ( scriptVarRecvTimeout && (now - start) > scriptVarRecvTimeout ) {
-            printf("ERROR: timeout waiting for string [%s]\n", string);
-            return 0;
-        }
-        num = rx_timeout((uint8_t *)buffer, 1, 1);
-        if ((num <= 0)) {
-            continue;
-        }
-        if (buffer[0] != *here) {
-            // reset our expectations
-            here = string;
-            continue;
-        }
-        here++;
-        if (!*here) {
-            break;
-        }
+    int timeout = scriptVarRecvTimeout ? scriptVarRecvTimeout : -1;
+
+    if (!*string) {
+        return 1;
+    }
+    if (!rx_until((uint8_t *)string, strlen(string), timeout)) {
+        printf("ERROR: timeout waiting for string [%s]\n", string);
+        return 0;
     }
     return 1;
 }
@@ -1556,6 +4097,7 @@ static int scriptSend(char *string)
         tx_raw_byte(c);
         count++;
         if ( scriptVarPauseAfter && count >= scriptVarPauseAfter) {
+            tx_flush();
             msleep(1);
             count = 0;
         }
@@ -1567,6 +4109,7 @@ static int scriptPausems(char *arg)
 {
     int delay = atoi(arg);
     if (delay > 0) {
+        tx_flush();
         msleep(delay);
     }
     return 1;
@@ -35,6 +35,7 @@
 
 /* serial i/o definitions */
 #define SERIAL_TIMEOUT  -1
+#define SERIAL_ERROR    -2  /* the port failed, or the device went away */
 #define EXIT_CHAR0 29 /* CTRL-] exits from terminal */
 #define EXIT_CHAR1 26 /* CTRL-Z also exits from terminal */
 
@@ -43,16 +44,27 @@ void serial_use_rts_for_reset(int use_rts);
 int serial_find(const char* prefix, int (*check)(const char* port, void* data), void* data);
 int serial_init(const char *port, unsigned long baud);
 int serial_baud(unsigned long baud);
+int serial_speed(unsigned long baud);
+unsigned long serial_actual_baud(void);
+int serial_usb_serial(char *buf, int len);
+const char *serial_latency_info(void);
+int serial_overruns(unsigned long *count);
+int serial_port_usb_info(const char *port, int *vid, int *pid, char *serial, int len);
 void serial_done(void);
 int tx(uint8_t* buff, int n);
+int tx_flush(void);
 int rx(uint8_t* buff, int n);
 int rx_timeout(uint8_t* buff, int n, int timeout);
+int rx_exact(uint8_t* buff, int n, int timeout);
+int rx_until(const uint8_t* pat, int len, int timeout);
 void hwreset(void);
+void serial_break(int ms);
 int flush_input(void);
 int wait_drain(void);
 
 /* terminal mode */
 void terminal_mode(int check_for_exit, int pst_mode);
+void pipe_mode(void);
 
 /* miscellaneous functions */
 void msleep(int ms);
@@ -63,6 +75,7 @@ unsigned long long elapsedms(void);
 /* external filesystem functions in the u9fs/u9fs.c */
 int u9fs_init(char *user_root);
 int u9fs_process(int count, char *buf);
+int u9fs_max_message(void);
 
 /* in loadp2.c */
 extern int waitAtExit; // if nonzero prompt before exiting
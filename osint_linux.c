@@ -28,6 +28,9 @@
  * THE SOFTWARE.
  * 
  */
+#ifdef __linux__
+#define _GNU_SOURCE /* for splice */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +42,8 @@
 #include <sys/ioctl.h>
 #include <sys/timeb.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <dirent.h>
@@ -50,14 +55,75 @@
 #include <IOKit/serial/ioss.h>
 #endif
 
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#if defined(__linux__) && defined(TCGETS2)
+//
+// Linux can set arbitrary baud rates with the termios2 interface
+// (BOTHER), but <asm/termbits.h> cannot be included alongside
+// <termios.h>, so we mirror the kernel structure here
+//
+#define USE_TERMIOS2
+#if defined(__mips__)
+#define KERNEL_NCCS 23
+#elif defined(__sparc__)
+#define KERNEL_NCCS 17
+#else
+#define KERNEL_NCCS 19
+#endif
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[KERNEL_NCCS];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+#endif
+
 #include "osint.h"
 
 typedef int HANDLE;
 static HANDLE hSerial = -1;
 static struct termios old_sparm;
 static unsigned long last_baud = -1;
+static unsigned long actual_baud = 0;
 static char last_port[PATH_MAX];
 
+/* small writes are collected here, and written out together by
+   tx_flush (which anything that waits on the other end calls) */
+#define TXBUF_SIZE 4096
+static uint8_t txbuf[TXBUF_SIZE];
+static int txlen = 0;
+
+/* give up if the port will not take any data for this long */
+#define TX_STALL_MS 5000
+
+/* input is read from the port in big pieces into here, and handed
+   out from here by the rx functions */
+#define RXBUF_SIZE 16384
+static uint8_t rxbuf[RXBUF_SIZE];
+static int rxhead = 0;  /* next byte to hand out */
+static int rxtail = 0;  /* end of valid data */
+
+/* what usb_low_latency changed, so restore_low_latency can put it back */
+static int lowlat_active = 0;
+static pid_t lowlat_owner;           /* only this process puts things back */
+static int lowlat_flag_set = 0;      /* we set ASYNC_LOW_LATENCY */
+static char lowlat_timer[PATH_MAX+64]; /* latency_timer we rewrote, if any */
+static char lowlat_old_timer[16];
+static char lowlat_info[128];
+
 extern int ignoreEof; /* in main file */
 
 /* normally we use DTR for reset but setting this variable to non-zero will use RTS instead */
@@ -85,22 +151,64 @@ int get_loader_baud(int ubaud, int lbaud)
     return lbaud;
 }
 
+static void usb_low_latency(void);
+static void restore_low_latency(void);
+
 static void sigint_handler(int signum)
 {
     serial_done();
     exit(1);
 }
 
+#ifdef USE_TERMIOS2
+//
+// set an arbitrary baud rate on an open port; afterwards actual_baud
+// holds the rate the driver says it achieved (after divisor rounding)
+//
+static int set_baud_termios2(HANDLE fd, unsigned long baud)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) != 0) {
+        return 0;
+    }
+    // input speed follows the output speed when its bits are 0
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = tio.c_ospeed = baud;
+    if (ioctl(fd, TCSETS2, &tio) != 0) {
+        return 0;
+    }
+    if (ioctl(fd, TCGETS2, &tio) == 0) {
+        actual_baud = tio.c_ospeed;
+    }
+    return 1;
+}
+#endif
+
 #if !defined(MACOSX)
 // MACOSX uses a different method to set baud
-static int set_baud(struct termios *sparm, unsigned long baud)
+// returns 0 if the baud rate was set in sparm, or the rate
+// to set later with set_baud_termios2 if it is non-standard
+static unsigned long set_baud(struct termios *sparm, unsigned long baud)
 {
     int tbaud = 0;
+    unsigned long custom = 0;
 
     switch(baud) {
         case 0: // default
             tbaud = B115200;
             break;
+#ifdef B4000000
+        case 4000000:
+            tbaud = B4000000;
+            break;
+#endif
+#ifdef B3000000
+        case 3000000:
+            tbaud = B3000000;
+            break;
+#endif
 #ifdef B2000000
         case 2000000:
             tbaud = B2000000;
@@ -147,6 +255,12 @@ static int set_baud(struct termios *sparm, unsigned long baud)
             tbaud = B9600;
             break;
         default:
+#ifdef USE_TERMIOS2
+            // placeholder, the real rate is set via termios2
+            tbaud = B38400;
+            custom = baud;
+            break;
+#else
             tbaud = baud;
             printf("Unsupported baudrate %lu. Use ", baud);
 #ifdef B921600
@@ -168,11 +282,30 @@ static int set_baud(struct termios *sparm, unsigned long baud)
             serial_done();
             promptexit(2);
             break;
+#endif
     }
 
     /* set raw input */
     chk("cfsetispeed", cfsetispeed(sparm, tbaud));
     chk("cfsetospeed", cfsetospeed(sparm, tbaud));
+    return custom;
+}
+
+// called after the termios settings from set_baud have been applied;
+// sets up any non-standard rate, and finds out what the driver really did
+static int finish_baud(unsigned long baud, unsigned long custom)
+{
+    actual_baud = baud;
+#ifdef USE_TERMIOS2
+    if (custom) {
+        return set_baud_termios2(hSerial, custom);
+    } else {
+        struct termios2 tio;
+        if (ioctl(hSerial, TCGETS2, &tio) == 0 && (tio.c_cflag & CBAUD) == BOTHER) {
+            actual_baud = tio.c_ospeed;
+        }
+    }
+#endif
     return 1;
 }
 #endif /* !MACOSX */
@@ -186,6 +319,9 @@ static int set_baud(struct termios *sparm, unsigned long baud)
 int serial_init(const char* port, unsigned long baud)
 {
     struct termios sparm;
+#if !defined(MACOSX)
+    unsigned long custom_baud;
+#endif
 
     /* open the port */
 #if defined(MACOSX)
@@ -195,6 +331,8 @@ int serial_init(const char* port, unsigned long baud)
 #else
     hSerial = open(port, O_RDWR | O_NOCTTY | O_NDELAY | O_NONBLOCK);
 #endif
+    txlen = 0;
+    rxhead = rxtail = 0;
     if(hSerial == -1) {
         //printf("error: opening '%s' -- %s\n", port, strerror(errno));
         return 0;
@@ -218,15 +356,22 @@ int serial_init(const char* port, unsigned long baud)
     cfsetospeed(&sparm, B9600); // dummy speed, overridden later
     cfsetispeed(&sparm, B9600); // dummy speed
 #else    
-    if (!set_baud(&sparm, baud)) {
+    custom_baud = set_baud(&sparm, baud);
+#endif
+    
+    /* set the options */
+    chk("tcsetattr", tcsetattr(hSerial, TCSANOW, &sparm));
+
+#if !defined(MACOSX)
+    if (!finish_baud(baud, custom_baud)) {
         close(hSerial);
+        hSerial = -1;
         printf("failure setting baud %ld\n", (long)baud);
         return 0;
     }
+#else
+    actual_baud = baud;
 #endif
-    
-    /* set the options */
-    chk("tcsetattr", tcsetattr(hSerial, TCSANOW, &sparm));
 
 #ifdef MACOSX
     if (ioctl(hSerial, IOSSIOSPEED, &speed) != 0)
@@ -237,6 +382,7 @@ int serial_init(const char* port, unsigned long baud)
     }
 #endif    
     chk("tcflush", tcflush(hSerial, TCIFLUSH));
+    usb_low_latency();
     
     return 1;
 }
@@ -253,6 +399,7 @@ int serial_baud(unsigned long baud)
 {
     if (baud != last_baud) {
         HANDLE oldSerial = hSerial;
+        tx_flush();
         if (!serial_init(last_port, baud)) {
             printf("serial_init of %s failed\n", last_port);
             promptexit(1);
@@ -262,11 +409,327 @@ int serial_baud(unsigned long baud)
     return 1;
 }
 
+/**
+ * change the baud rate of the open port in place
+ * @param baud - baud rate
+ * @returns 1 for success and 0 for failure
+ * Unlike serial_baud this does not re-open the port; it is used
+ * to switch rates in the middle of a conversation with the P2, so
+ * any pending output is sent at the old rate first.
+ */
+int serial_speed(unsigned long baud)
+{
+#if defined(MACOSX)
+    speed_t speed = (speed_t) baud;
+
+    wait_drain();
+    if (ioctl(hSerial, IOSSIOSPEED, &speed) != 0) {
+        return 0;
+    }
+    actual_baud = baud;
+#else
+    struct termios sparm;
+    unsigned long custom;
+
+    wait_drain();
+    if (tcgetattr(hSerial, &sparm) != 0) {
+        return 0;
+    }
+    custom = set_baud(&sparm, baud);
+    if (tcsetattr(hSerial, TCSANOW, &sparm) != 0) {
+        return 0;
+    }
+    if (!finish_baud(baud, custom)) {
+        return 0;
+    }
+#endif
+    last_baud = baud;
+    return 1;
+}
+
+/**
+ * find the baud rate the port is really running at; some drivers
+ * can only approximate the requested rate
+ */
+unsigned long serial_actual_baud(void)
+{
+    return actual_baud;
+}
+
+/*
+ * find the sysfs directory of the device behind a port's tty
+ * (for USB adapters this is the usb-serial port, e.g. ttyUSB0)
+ * returns 1 on success, 0 if there is none
+ */
+static int tty_device_dir(const char *port, char *dir, size_t len)
+{
+    char path[PATH_MAX+32], real[PATH_MAX];
+    char *name;
+
+    if (!realpath(port, real)) {
+        return 0;
+    }
+    name = strrchr(real, '/');
+    name = name ? name + 1 : real;
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device", name);
+    if (!realpath(path, real)) {
+        return 0;
+    }
+    snprintf(dir, len, "%s", real);
+    return 1;
+}
+
+/*
+ * find the sysfs directory of the USB device behind a port
+ * (the first parent of the tty's device which has an idVendor)
+ * returns 1 on success, 0 if there is none (e.g. not a USB adapter)
+ */
+static int usb_device_dir(const char *port, char *dir, size_t len)
+{
+    char path[PATH_MAX+32], real[PATH_MAX];
+    char *p;
+
+    if (!tty_device_dir(port, real, sizeof(real))) {
+        return 0;
+    }
+    for(;;) {
+        snprintf(path, sizeof(path), "%s/idVendor", real);
+        if (access(path, R_OK) == 0) {
+            snprintf(dir, len, "%s", real);
+            return 1;
+        }
+        p = strrchr(real, '/');
+        if (!p || p == real) {
+            return 0;
+        }
+        *p = 0;
+    }
+}
+
+/*
+ * read the first line of a sysfs attribute
+ * returns 1 on success, 0 on failure
+ */
+static int read_sysfs(const char *dir, const char *attr, char *buf, int len)
+{
+    char path[PATH_MAX+64];
+    FILE *f;
+    char *p;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    p = strchr(buf, '\n');
+    if (p) *p = 0;
+    return buf[0] != 0;
+}
+
+/**
+ * get the serial number of the USB adapter behind the open port
+ * @returns 1 on success, 0 if there is none
+ */
+int serial_usb_serial(char *buf, int len)
+{
+    char dir[PATH_MAX];
+
+    if (!usb_device_dir(last_port, dir, sizeof(dir))) {
+        return 0;
+    }
+    return read_sysfs(dir, "serial", buf, len);
+}
+
+/**
+ * look up the USB adapter behind a port, which need not be open
+ * @param vid, pid - set to the USB vendor and product ids
+ * @param serial - if not NULL, set to the serial number ("" if none)
+ * @returns 1 if the port is on a USB device, 0 if not (or unknown)
+ */
+int serial_port_usb_info(const char *port, int *vid, int *pid, char *serial, int len)
+{
+    char dir[PATH_MAX], val[16];
+
+    if (!usb_device_dir(port, dir, sizeof(dir))) {
+        return 0;
+    }
+    if (!read_sysfs(dir, "idVendor", val, sizeof(val))) {
+        return 0;
+    }
+    *vid = (int)strtol(val, NULL, 16);
+    *pid = read_sysfs(dir, "idProduct", val, sizeof(val)) ? (int)strtol(val, NULL, 16) : 0;
+    if (serial && !read_sysfs(dir, "serial", serial, len)) {
+        serial[0] = 0;
+    }
+    return 1;
+}
+
+/*
+ * write a sysfs attribute
+ * returns 1 on success, 0 on failure (often for lack of permission)
+ */
+static int write_sysfs(const char *path, const char *val)
+{
+    FILE *f = fopen(path, "w");
+    int ok;
+
+    if (!f) {
+        return 0;
+    }
+    ok = fputs(val, f) >= 0;
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+/*
+ * put FTDI, CP210x and CH34x adapters into their lowest latency
+ * configuration; every loader reply and 9P message is a round trip,
+ * and FTDI parts otherwise hold received data for up to 16 ms
+ *
+ * Setting ASYNC_LOW_LATENCY is allowed for ordinary users, and on
+ * FTDI parts it also drops the latency timer to 1 ms. If that did
+ * not work we try writing latency_timer directly, which usually
+ * needs a udev rule (or root).
+ */
+static void usb_low_latency(void)
+{
+#ifdef __linux__
+    char dir[PATH_MAX], link[PATH_MAX+32], drv[PATH_MAX];
+    char val[16];
+    const char *chip, *mode;
+    struct serial_struct ss;
+    int n;
+
+    if (lowlat_active) {
+        // serial_baud re-opened the same port; the settings belong to
+        // the port, not the handle, so they are still in place
+        return;
+    }
+    lowlat_flag_set = 0;
+    lowlat_timer[0] = 0;
+    lowlat_info[0] = 0;
+    if (!tty_device_dir(last_port, dir, sizeof(dir))) {
+        return;
+    }
+    snprintf(link, sizeof(link), "%s/driver", dir);
+    n = readlink(link, drv, sizeof(drv)-1);
+    if (n <= 0) {
+        return;
+    }
+    drv[n] = 0;
+    chip = strrchr(drv, '/');
+    chip = chip ? chip + 1 : drv;
+    if (strcmp(chip, "ftdi_sio") != 0 && strcmp(chip, "cp210x") != 0
+        && strcmp(chip, "ch341-uart") != 0 && strcmp(chip, "ch341") != 0)
+    {
+        return;
+    }
+
+    mode = "not supported";
+    if (ioctl(hSerial, TIOCGSERIAL, &ss) == 0) {
+        if (ss.flags & ASYNC_LOW_LATENCY) {
+            mode = "already on";
+        } else {
+            ss.flags |= ASYNC_LOW_LATENCY;
+            if (ioctl(hSerial, TIOCSSERIAL, &ss) == 0) {
+                lowlat_flag_set = 1;
+                mode = "on";
+            }
+        }
+    }
+    snprintf(lowlat_info, sizeof(lowlat_info), "%.32s: low latency mode %s", chip, mode);
+
+    if (read_sysfs(dir, "latency_timer", val, sizeof(val))) {
+        if (atoi(val) > 1) {
+            snprintf(lowlat_timer, sizeof(lowlat_timer), "%s/latency_timer", dir);
+            if (write_sysfs(lowlat_timer, "1")) {
+                snprintf(lowlat_old_timer, sizeof(lowlat_old_timer), "%s", val);
+                snprintf(val, sizeof(val), "1");
+            } else {
+                lowlat_timer[0] = 0;
+            }
+        }
+        n = strlen(lowlat_info);
+        snprintf(lowlat_info + n, sizeof(lowlat_info) - n, ", latency timer %s ms", val);
+    }
+    if (lowlat_flag_set || lowlat_timer[0]) {
+        static int registered = 0;
+        lowlat_active = 1;
+        lowlat_owner = getpid();
+        if (!registered) {
+            atexit(restore_low_latency);
+            registered = 1;
+        }
+    }
+#endif
+}
+
+/*
+ * undo whatever usb_low_latency changed
+ */
+static void restore_low_latency(void)
+{
+#ifdef __linux__
+    struct serial_struct ss;
+
+    if (!lowlat_active || lowlat_owner != getpid()) {
+        // a child of a loader server is finished with the port, but
+        // the server is not
+        return;
+    }
+    if (lowlat_flag_set && hSerial != -1 && ioctl(hSerial, TIOCGSERIAL, &ss) == 0) {
+        ss.flags &= ~ASYNC_LOW_LATENCY;
+        ioctl(hSerial, TIOCSSERIAL, &ss);
+    }
+    if (lowlat_timer[0]) {
+        write_sysfs(lowlat_timer, lowlat_old_timer);
+    }
+    lowlat_active = 0;
+    lowlat_flag_set = 0;
+    lowlat_timer[0] = 0;
+#endif
+}
+
+/**
+ * describe the latency settings made when the port was opened
+ * @returns a string, or NULL if nothing was changed or checked
+ */
+const char *serial_latency_info(void)
+{
+    return lowlat_info[0] ? lowlat_info : NULL;
+}
+
+/**
+ * number of receive overruns on the port so far (in the UART and in
+ * the driver's buffer), if the driver counts them
+ * @returns 0 on success, -1 if not available
+ */
+int serial_overruns(unsigned long *count)
+{
+#if defined(__linux__) && defined(TIOCGICOUNT)
+    struct serial_icounter_struct icount;
+
+    if (ioctl(hSerial, TIOCGICOUNT, &icount) == 0) {
+        *count = icount.overrun + icount.buf_overrun;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
 /**
  * flush all input
  */
 int flush_input(void)
 {
+    rxhead = rxtail = 0;
     return tcflush(hSerial, TCIFLUSH);
 }
 
@@ -275,6 +738,7 @@ int flush_input(void)
  */
 int wait_drain(void)
 {
+    tx_flush();
     return tcdrain(hSerial);
 }
 
@@ -284,7 +748,11 @@ int wait_drain(void)
 void serial_done(void)
 {
     if (hSerial != -1) {
-        tcflush(hSerial, TCIOFLUSH);
+        // let anything we sent get out before the port closes; only
+        // unread input is thrown away
+        wait_drain();
+        tcflush(hSerial, TCIFLUSH);
+        restore_low_latency();
         //tcsetattr(hSerial, TCSANOW, &old_sparm);
         ioctl(hSerial, TIOCNXCL);
         close(hSerial);
@@ -300,7 +768,13 @@ void serial_done(void)
  */
 int rx(uint8_t* buff, int n)
 {
-    ssize_t bytes = read(hSerial, buff, n);
+    ssize_t bytes;
+
+    tx_flush();
+    if (rxtail > rxhead) {
+        return rx_timeout(buff, n, 0);
+    }
+    bytes = read(hSerial, buff, n);
     if(bytes < 1) {
         printf("Error reading port: %d\n", (int)bytes);
         return 0;
@@ -308,15 +782,63 @@ int rx(uint8_t* buff, int n)
     return (int)bytes;
 }
 
+/**
+ * write a whole buffer to the port, coping with partial writes
+ * and with the port not being ready
+ * @returns zero on failure
+ */
+static int write_all(const uint8_t* buff, int n)
+{
+    ssize_t bytes;
+    struct pollfd pfd;
+
+    while (n > 0) {
+        bytes = write(hSerial, buff, n);
+        if (bytes > 0) {
+            buff += bytes;
+            n -= bytes;
+            continue;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pfd.fd = hSerial;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, TX_STALL_MS) > 0) {
+                continue;
+            }
+        }
+        printf("Error writing port\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * send any buffered output
+ * @returns zero on failure
+ */
+int tx_flush(void)
+{
+    int r = 1;
+    if (txlen > 0) {
+        r = write_all(txbuf, txlen);
+        txlen = 0;
+    }
+    return r;
+}
+
 /**
  * transmit a buffer
+ * the data may be held back until tx_flush (which reading,
+ * draining, or waiting for input all do first)
  * @param buff - char pointer to buffer
  * @param n - number of bytes in buffer to send
  * @returns zero on failure
  */
 int tx(uint8_t* buff, int n)
 {
-    ssize_t bytes;
 #if 0
     int j = 0;
     while(j < n) {
@@ -324,39 +846,164 @@ int tx(uint8_t* buff, int n)
     }
     printf("tx %d byte(s)\n",n);
 #endif
-    bytes = write(hSerial, buff, n);
-    if(bytes != n) {
-        printf("Error writing port\n");
-        return 0;
+    if (txlen + n > TXBUF_SIZE) {
+        if (!tx_flush()) {
+            return 0;
+        }
     }
-    return (int)bytes;
+    if (n >= TXBUF_SIZE) {
+        return write_all(buff, n) ? n : 0;
+    }
+    memcpy(txbuf + txlen, buff, n);
+    txlen += n;
+    return n;
 }
 
 /**
- * receive a buffer with a timeout
- * @param buff - char pointer to buffer
- * @param n - number of bytes in buffer to read
- * @param timeout - timeout in milliseconds
- * @returns number of bytes read or SERIAL_TIMEOUT
+ * wait up to timeout ms (forever if timeout < 0) for input, and read
+ * as much as there is room for into rxbuf
+ * @returns number of bytes added, 0 on timeout, -1 if the port failed
+ * or was closed at the other end
  */
-int rx_timeout(uint8_t* buff, int n, int timeout)
+static int rx_fill(int timeout)
 {
     ssize_t bytes = 0;
     struct timeval toval;
     fd_set set;
+    int r;
 
+    tx_flush();
+    if (rxhead == rxtail) {
+        rxhead = rxtail = 0;
+    } else if (rxtail == RXBUF_SIZE) {
+        memmove(rxbuf, rxbuf + rxhead, rxtail - rxhead);
+        rxtail -= rxhead;
+        rxhead = 0;
+    }
     FD_ZERO(&set);
     FD_SET(hSerial, &set);
 
     toval.tv_sec = timeout / 1000;
     toval.tv_usec = (timeout % 1000) * 1000;
 
-    if (select(hSerial + 1, &set, NULL, NULL, &toval) > 0) {
-        if (FD_ISSET(hSerial, &set))
-            bytes = read(hSerial, buff, n);
+    r = select(hSerial + 1, &set, NULL, NULL, timeout < 0 ? NULL : &toval);
+    if (r < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (r > 0 && FD_ISSET(hSerial, &set)) {
+        bytes = read(hSerial, rxbuf + rxtail, RXBUF_SIZE - rxtail);
+        if (bytes == 0 || (bytes < 0 && errno != EINTR && errno != EAGAIN)) {
+            return -1;
+        }
+    }
+    if (bytes <= 0) {
+        return 0;
+    }
+    rxtail += bytes;
+    return (int)bytes;
+}
+
+/**
+ * receive a buffer with a timeout
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes in buffer to read
+ * @param timeout - timeout in milliseconds
+ * @returns number of bytes read, SERIAL_TIMEOUT or SERIAL_ERROR
+ */
+int rx_timeout(uint8_t* buff, int n, int timeout)
+{
+    int bytes;
+
+    if (rxhead == rxtail) {
+        bytes = rx_fill(timeout);
+        if (bytes <= 0) {
+            return (bytes < 0) ? SERIAL_ERROR : SERIAL_TIMEOUT;
+        }
+    }
+    bytes = rxtail - rxhead;
+    if (bytes > n) {
+        bytes = n;
     }
+    memcpy(buff, rxbuf + rxhead, bytes);
+    rxhead += bytes;
+    return bytes;
+}
+
+/**
+ * receive exactly n bytes, waiting at most timeout ms in all
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes to read
+ * @param timeout - timeout in milliseconds
+ * @returns number of bytes read (less than n on timeout or error)
+ */
+int rx_exact(uint8_t* buff, int n, int timeout)
+{
+    unsigned long long deadline = elapsedms() + timeout;
+    unsigned long long now;
+    int got = 0;
+    int r;
 
-    return (int)(bytes > 0 ? bytes : SERIAL_TIMEOUT);
+    while (got < n) {
+        r = rx_timeout(buff + got, n - got, 0);
+        if (r > 0) {
+            got += r;
+            continue;
+        }
+        now = elapsedms();
+        if (r == SERIAL_ERROR || now >= deadline) {
+            break;
+        }
+        if (rx_fill((int)(deadline - now)) < 0) {
+            break;
+        }
+    }
+    return got;
+}
+
+/**
+ * throw away input up to and including the first occurrence of pat
+ * @param pat - bytes to look for
+ * @param len - length of pat
+ * @param timeout - timeout in milliseconds (forever if < 0)
+ * @returns 1 if pat was seen, 0 on timeout or error
+ */
+int rx_until(const uint8_t* pat, int len, int timeout)
+{
+    unsigned long long deadline = elapsedms() + timeout;
+    unsigned long long now;
+    int match = 0;
+    int k;
+    uint8_t c;
+
+    for(;;) {
+        while (rxhead < rxtail) {
+            c = rxbuf[rxhead++];
+            /* on a mismatch, fall back to the longest part of what
+               matched so far that could still start a match */
+            while (match > 0 && c != pat[match]) {
+                for (k = match - 1; k > 0; k--) {
+                    if (!memcmp(pat, pat + match - k, k)) break;
+                }
+                match = k;
+            }
+            if (c == pat[match] && ++match == len) {
+                return 1;
+            }
+        }
+        if (timeout < 0) {
+            if (rx_fill(-1) < 0) {
+                return 0;
+            }
+            continue;
+        }
+        now = elapsedms();
+        if (now >= deadline) {
+            return 0;
+        }
+        if (rx_fill((int)(deadline - now)) < 0) {
+            return 0;
+        }
+    }
 }
 
 /**
@@ -367,13 +1014,25 @@ int rx_timeout(uint8_t* buff, int n, int timeout)
 void hwreset(void)
 {
     int cmd = use_rts_for_reset ? TIOCM_RTS : TIOCM_DTR;
+    tx_flush();
     ioctl(hSerial, TIOCMBIS, &cmd); /* assert bit */
     msleep(2);
     ioctl(hSerial, TIOCMBIC, &cmd); /* clear bit */
     msleep(2);
     ioctl(hSerial, TIOCMBIS, &cmd); /* assert bit */
     msleep(2);
-    tcflush(hSerial, TCIFLUSH);
+    flush_input();
+}
+
+/**
+ * hold the transmit line low (a break) for ms milliseconds
+ */
+void serial_break(int ms)
+{
+    wait_drain();
+    ioctl(hSerial, TIOCSBRK);
+    msleep(ms);
+    ioctl(hSerial, TIOCCBRK);
 }
 
 /**
@@ -395,33 +1054,404 @@ void msleep(int ms)
 #endif
 }
 
+/* how much keyboard input terminal_mode reads at a time */
+#define TERM_BUF_SIZE 4096
+
+/* console output from terminal_mode goes through this ring, so that a
+   slow reader of stdout never holds up reading the serial port; if the
+   ring fills up, output goes to a spill file until the ring catches up */
+#define CONSOLE_RING_SIZE (1024*1024)
+// when stdout has to be written blocking, we write no more after poll
+// says it is writable than a pipe promises to take in one go
+#define CONSOLE_WRITE_MAX PIPE_BUF
+static int con_fd = STDOUT_FILENO;     /* where console output goes */
+static int con_nonblock;               /* con_fd is ours, and non-blocking */
+static int con_socket;                 /* stdout is a socket */
+static char *con_ring;
+static size_t con_head;                /* oldest byte in the ring */
+static size_t con_len;                 /* bytes in the ring */
+static FILE *con_spill;                /* output the ring had no room for */
+static long con_spill_rd, con_spill_wr;
+static unsigned long long con_spilled; /* bytes that went to con_spill */
+static unsigned long long con_dropped; /* bytes that could not be kept */
+
+/**
+ * add output that the ring has no room for to the spill file
+ */
+static void con_spill_out(const char *buf, size_t n)
+{
+    size_t r = 0;
+
+    if (!con_spill) {
+        con_spill = tmpfile();
+    }
+    if (con_spill && fseek(con_spill, con_spill_wr, SEEK_SET) == 0) {
+        r = fwrite(buf, 1, n, con_spill);
+    }
+    con_spill_wr += r;
+    con_spilled += r;
+    con_dropped += n - r;
+}
+
+/**
+ * check whether stdout can take more output
+ * @param wait - if non-zero, wait until it can
+ */
+static int con_writable(int wait)
+{
+    struct pollfd pfd;
+    int r;
+
+    pfd.fd = con_fd;
+    pfd.events = POLLOUT;
+    do {
+        r = poll(&pfd, 1, wait ? -1 : 0);
+    } while (r < 0 && errno == EINTR);
+    // on an error let write() find out what is wrong
+    return r != 0;
+}
+
+/**
+ * write up to n bytes of console output without waiting
+ * @returns as for write(); -1 with errno EAGAIN if stdout is full
+ */
+static ssize_t con_write(const char *buf, size_t n)
+{
+    if (con_socket) {
+        return send(con_fd, buf, n, MSG_DONTWAIT);
+    }
+    if (con_nonblock) {
+        return write(con_fd, buf, n);
+    }
+    // a pipe or a file: poll, then write no more than it will take
+    if (!con_writable(0)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return write(con_fd, buf, n < CONSOLE_WRITE_MAX ? n : CONSOLE_WRITE_MAX);
+}
+
+/**
+ * write as much console output as stdout will take
+ * @param wait - if non-zero, wait until all of it is written
+ */
+static void con_drain(int wait)
+{
+    size_t n;
+    ssize_t r;
+
+    for (;;) {
+        if (con_len == 0 && con_spill_rd < con_spill_wr) {
+            // the ring has caught up; bring back what was spilled
+            fflush(con_spill);
+            if (fseek(con_spill, con_spill_rd, SEEK_SET) == 0) {
+                con_head = 0;
+                con_len = fread(con_ring, 1, CONSOLE_RING_SIZE, con_spill);
+            }
+            if (con_len == 0) {
+                con_dropped += con_spill_wr - con_spill_rd;
+                con_spill_rd = con_spill_wr;
+            }
+            con_spill_rd += con_len;
+            if (con_spill_rd == con_spill_wr) {
+                con_spill_rd = con_spill_wr = 0;
+            }
+        }
+        if (con_len == 0) {
+            return;
+        }
+        n = CONSOLE_RING_SIZE - con_head;
+        if (n > con_len) n = con_len;
+        r = con_write(con_ring + con_head, n);
+        if (r > 0) {
+            con_head = (con_head + r) % CONSOLE_RING_SIZE;
+            con_len -= r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!wait) {
+                return;
+            }
+            con_writable(1);
+            continue;
+        }
+        // nobody is reading any more
+        con_dropped += con_len + (con_spill_wr - con_spill_rd);
+        con_len = 0;
+        con_spill_rd = con_spill_wr = 0;
+        return;
+    }
+}
+
+/**
+ * queue console output; this never waits for stdout
+ */
+static void con_out(const char *buf, size_t n)
+{
+    size_t room, tail, k;
+    ssize_t r;
+
+    if (!con_ring) {
+        // no ring: fall back to plain writes
+        while (n > 0 && ((r = write(STDOUT_FILENO, buf, n)) > 0 || errno == EINTR)) {
+            if (r > 0) {
+                buf += r;
+                n -= r;
+            }
+        }
+        return;
+    }
+    if (con_len == 0 && con_spill_rd == con_spill_wr) {
+        // nothing is waiting, so try to write it straight away
+        while (n > 0 && ((r = con_write(buf, n)) > 0 || (r < 0 && errno == EINTR))) {
+            if (r > 0) {
+                buf += r;
+                n -= r;
+            }
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+    if (con_spill_rd < con_spill_wr) {
+        // older output is already in the spill file; keep it in order
+        con_spill_out(buf, n);
+        return;
+    }
+    room = CONSOLE_RING_SIZE - con_len;
+    k = n < room ? n : room;
+    tail = (con_head + con_len) % CONSOLE_RING_SIZE;
+    if (k > CONSOLE_RING_SIZE - tail) {
+        memcpy(con_ring + tail, buf, CONSOLE_RING_SIZE - tail);
+        memcpy(con_ring, buf + (CONSOLE_RING_SIZE - tail), k - (CONSOLE_RING_SIZE - tail));
+    } else {
+        memcpy(con_ring + tail, buf, k);
+    }
+    con_len += k;
+    if (k < n) {
+        con_spill_out(buf + k, n - k);
+    }
+}
+
+/**
+ * start queueing console output. stdout's file flags are left alone,
+ * since its open file description may be shared with the user's shell
+ * (or, under -SERVE, with a client). Instead a terminal, or on Linux a
+ * pipe, is opened again, which gives us a description of our own to
+ * make non-blocking, and a socket is sent to with MSG_DONTWAIT. Anything
+ * else is polled, and written a little at a time.
+ */
+static void con_start(void)
+{
+    struct stat st;
+    const char *name = NULL;
+    int fd = -1;
+
+    fflush(stdout);
+    if (!con_ring) {
+        con_ring = malloc(CONSOLE_RING_SIZE);
+    }
+    con_fd = STDOUT_FILENO;
+    con_nonblock = con_socket = 0;
+    if (fstat(STDOUT_FILENO, &st) != 0) {
+        return;
+    }
+    if (S_ISSOCK(st.st_mode)) {
+        con_socket = 1;
+        return;
+    }
+    if (isatty(STDOUT_FILENO)) {
+        name = ttyname(STDOUT_FILENO);
+#ifdef __linux__
+    } else if (S_ISFIFO(st.st_mode)) {
+        name = "/proc/self/fd/1";
+#endif
+    }
+    if (name) {
+        fd = open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+    }
+    if (fd >= 0) {
+        con_fd = fd;
+        con_nonblock = 1;
+    }
+}
+
+/**
+ * wait for all queued console output to be written, and report any
+ * that had to be spilled or dropped
+ */
+static void con_finish(void)
+{
+    con_drain(1);
+    if (con_spilled || con_dropped) {
+        fprintf(stderr, "[ console output: %llu bytes spilled to a temporary file, %llu bytes dropped ]\n",
+                con_spilled, con_dropped);
+    }
+    if (con_spill) {
+        fclose(con_spill);
+        con_spill = NULL;
+    }
+    con_spilled = con_dropped = 0;
+    if (con_nonblock) {
+        close(con_fd);
+    }
+    con_fd = STDOUT_FILENO;
+    con_nonblock = con_socket = 0;
+}
+
+/**
+ * how many bytes at the start of p can pass straight through to the
+ * console: everything up to the escape (if enabled) or, in PST mode, a
+ * CR. memchr does the scanning, so runs of plain text are not looked at
+ * a byte at a time
+ */
+static int term_span(const char *p, int n, int exit_char, int pst_mode)
+{
+    const char *e;
+
+    if (exit_char <= 0xff && (e = memchr(p, exit_char, n)) != NULL) {
+        n = e - p;
+    }
+    if (pst_mode && (e = memchr(p, '\r', n)) != NULL) {
+        n = e - p;
+    }
+    return n;
+}
+
+/*
+ * What the device sends in terminal mode is console text, in which
+ * (when escapes are enabled) 0xff starts one of:
+ *   ff 00 <status>       the program has exited with <status>
+ *   ff 01 <9P message>   a 9P request, starting with its 4 byte size
+ *   ff <anything else>   just those two bytes of text
+ * The demultiplexer splits this up as it arrives, however it happens
+ * to be divided into reads. 9P requests are collected whole and then
+ * handed to u9fs, so u9fs never has to read from the port itself and
+ * console text around them is never held up or lost.
+ */
+#define ESCAPE_CHAR 0xff
+
+enum { DM_CONSOLE, DM_ESCAPE, DM_EXIT, DM_9P };
+
+struct demux {
+    int state;
+    int escapes;      /* look for ESCAPE_CHAR at all */
+    int files;        /* pass 9P requests to u9fs */
+    int pst;          /* turn CR into CR LF */
+    int exited;       /* exit sequence seen */
+    int exitcode;
+    char *msg;        /* 9P request being collected */
+    int msglen;
+    int msgsize;      /* its size, once known (0 before) */
+};
+
+/**
+ * take n bytes from the device, adding console text to out (which
+ * needs room for 2*n bytes) and handing complete 9P requests to u9fs;
+ * stops after an exit sequence
+ * @returns how many bytes were used
+ */
+static int demux(struct demux *d, const char *p, int n, char *out, int *outlen)
+{
+    int i = 0, k, c;
+    int max;
+
+    while (i < n && !d->exited) {
+        switch (d->state) {
+        case DM_CONSOLE:
+            k = term_span(p + i, n - i, d->escapes ? ESCAPE_CHAR : 0xdead, d->pst);
+            memcpy(out + *outlen, p + i, k);
+            *outlen += k;
+            i += k;
+            if (i < n) {
+                if ((p[i++] & 0xff) == ESCAPE_CHAR && d->escapes) {
+                    d->state = DM_ESCAPE;
+                } else {
+                    out[(*outlen)++] = '\r';
+                    out[(*outlen)++] = '\n';
+                }
+            }
+            break;
+        case DM_ESCAPE:
+            c = p[i++] & 0xff;
+            if (c == 0) {
+                d->state = DM_EXIT;
+            } else if (c == 1 && d->files) {
+                d->state = DM_9P;
+                d->msglen = d->msgsize = 0;
+            } else {
+                out[(*outlen)++] = (char)ESCAPE_CHAR;
+                out[(*outlen)++] = c;
+                d->state = DM_CONSOLE;
+            }
+            break;
+        case DM_EXIT:
+            d->exitcode = p[i++] & 0xff;
+            d->exited = 1;
+            break;
+        case DM_9P:
+            max = u9fs_max_message();
+            if (!d->msg) {
+                d->msg = malloc(max);
+                if (!d->msg) {
+                    fprintf(stderr, "Out of memory for 9P\n");
+                    d->state = DM_CONSOLE;
+                    break;
+                }
+            }
+            k = (d->msgsize ? d->msgsize : 4) - d->msglen;
+            if (k > n - i) k = n - i;
+            memcpy(d->msg + d->msglen, p + i, k);
+            d->msglen += k;
+            i += k;
+            if (!d->msgsize && d->msglen == 4) {
+                d->msgsize = (d->msg[0] & 0xff) | ((d->msg[1] & 0xff) << 8)
+                    | ((d->msg[2] & 0xff) << 16) | ((unsigned)(d->msg[3] & 0xff) << 24);
+                if (d->msgsize <= 4 || d->msgsize > max) {
+                    fprintf(stderr, "Ignoring 9P request of bad size %d\n", d->msgsize);
+                    d->state = DM_CONSOLE;
+                }
+            } else if (d->msgsize && d->msglen == d->msgsize) {
+                u9fs_process(d->msglen, d->msg);
+                d->state = DM_CONSOLE;
+            }
+            break;
+        }
+    }
+    return i;
+}
+
 /**
  * simple terminal emulator
  */
 void terminal_mode(int runterm_mode, int pst_mode)
 {
     struct termios oldt, newt;
-    char buf[128], realbuf[256]; // double in case buf is filled with \r in PST mode
+    char buf[TERM_BUF_SIZE];
+    static char out[2*RXBUF_SIZE]; // every byte may become two
+    struct demux dm;
     ssize_t cnt;
     fd_set set;
-    int exit_char = 0xdead; /* not a valid character */
-    int sawexit_char = 0;
-    int sawexit_valid = 0; 
-    int exitcode = 0;
-    int continue_terminal = 1;
-    int check_for_exit = runterm_mode != 0;
-    int check_for_files = runterm_mode & 2;
+    int ready, maxfd;
+    int outlen;
+    fd_set wset;
     
+    // device output is queued for stdout and written when stdout can
+    // take it, so the serial port never waits for whoever reads stdout
+    con_start();
     if (isatty(STDIN_FILENO)) {
         tcgetattr(STDIN_FILENO, &oldt);
         newt = oldt;
         cfmakeraw(&newt);
         tcsetattr(STDIN_FILENO, TCSANOW, &newt);
     }
-    if (check_for_exit)
-      {
-        exit_char = 0xff;
-      }
+    memset(&dm, 0, sizeof(dm));
+    dm.escapes = runterm_mode != 0;
+    dm.files = (runterm_mode & 2) != 0;
+    dm.pst = pst_mode;
 
 #if 0
     /* make it possible to detect breaks */
@@ -432,49 +1462,31 @@ void terminal_mode(int runterm_mode, int pst_mode)
 #endif
 
     do {
+        tx_flush(); /* e.g. replies from u9fs */
+        con_drain(0);
         FD_ZERO(&set);
+        FD_ZERO(&wset);
         FD_SET(hSerial, &set);
-        FD_SET(STDIN_FILENO, &set);
-        if (select(hSerial + 1, &set, NULL, NULL, NULL) > 0) {
+        if (rxhead < rxtail) {
+            /* input left over from earlier; handle that first */
+            ready = 1;
+        } else {
+            FD_SET(STDIN_FILENO, &set);
+            maxfd = hSerial;
+            if (con_len > 0) {
+                // wake up when stdout can take more
+                FD_SET(con_fd, &wset);
+                if (con_fd > maxfd) maxfd = con_fd;
+            }
+            ready = select(maxfd + 1, &set, &wset, NULL, NULL);
+        }
+        if (ready > 0) {
             if (FD_ISSET(hSerial, &set)) {
-                if ((cnt = read(hSerial, buf, sizeof(buf))) > 0) {
-                    int i;
-                    // check for breaks
-                    ssize_t realbytes = 0;
-                    for (i = 0; i < cnt; i++) {
-                      if (sawexit_valid)
-                        {
-                          exitcode = buf[i];
-                          //printf("exitcode: %02x\n", buf[i]);
-                          continue_terminal = 0;
-                        }
-                      else if (sawexit_char) {
-                        //printf("exitchar 2: %02x\n", buf[i]);
-                        if (buf[i] == 0) {
-                          sawexit_valid = 1;
-                        } else if (buf[i] == 1 && check_for_files) {
-                            int r = u9fs_process(cnt - (i+1), &buf[i+1]);
-//                            printf("u9fs_process(%d) returned: %d\n", cnt - (i+1), r);
-                            i += (r-1);
-                            sawexit_char = 0;
-                            break;
-                        } else {
-                          realbuf[realbytes++] = exit_char;
-                          realbuf[realbytes++] = buf[i];
-                          sawexit_char = 0;
-                        }
-                      } else if (((int)buf[i] & 0xff) == exit_char) {
-                        //printf("exitchar: %02x\n", buf[i]);
-                        sawexit_char = 1;
-                      } else {
-                        realbuf[realbytes++] = buf[i];
-                        if (pst_mode && buf[i] == '\r')
-                            realbuf[realbytes++] = '\n';
-                      }
-                    }
-                    if (realbytes > 0) {
-                        write(fileno(stdout), realbuf, realbytes);
-                    }
+                // work straight from the receive buffer
+                if (rxhead < rxtail || rx_fill(0) > 0) {
+                    outlen = 0;
+                    rxhead += demux(&dm, (char *)rxbuf + rxhead, rxtail - rxhead, out, &outlen);
+                    con_out(out, outlen);
                 }
             }
             if (FD_ISSET(STDIN_FILENO, &set)) {
@@ -485,38 +1497,182 @@ void terminal_mode(int runterm_mode, int pst_mode)
                     goto done;
                 }
                 if (cnt > 0) {
-                    int i;
-                    for (i = 0; i < cnt; ++i) {
-                        //printf("%02x\n", buf[i]);
-                        if (buf[i] == EXIT_CHAR0 || buf[i] == EXIT_CHAR1) {
-                            waitAtExit = 0; // user chose to quit
-                            goto done;
-                        }
+                    if (memchr(buf, EXIT_CHAR0, cnt) || memchr(buf, EXIT_CHAR1, cnt)) {
+                        waitAtExit = 0; // user chose to quit
+                        goto done;
                     }
-                    write(hSerial, buf, cnt);
+                    tx((uint8_t *)buf, cnt);
                 }
             }
         }
-    } while (continue_terminal);
+    } while (!dm.exited);
 
 done:
     if (isatty(STDIN_FILENO)) {
         tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
     }
+    con_finish();
+    free(dm.msg);
 
-    if (sawexit_valid)
+    if (dm.exited)
       {
-        promptexit(exitcode);
+        promptexit(dm.exitcode);
       }
     
 }
 
+/* pipe_mode moves data this much at a time */
+#define PIPE_BUF_SIZE 65536
+/* after EOF on stdin, pipe_mode stops once the device is quiet this long */
+#define PIPE_IDLE_MS 250
+
+/**
+ * transparent pipe between stdin/stdout and the device: input is sent
+ * as it is (no exit characters), and output is passed on as it is,
+ * except that the exit sequence 0xff 0x00 <status> ends the session
+ * with that status, like -t. EOF on stdin also ends it (unless EOF is
+ * being ignored), once the input has been sent and the device has
+ * gone quiet. On Linux, input from a pipe is spliced straight to the
+ * port where the kernel allows it
+ */
+void pipe_mode(void)
+{
+    static char inbuf[PIPE_BUF_SIZE];
+    static char out[2*RXBUF_SIZE];
+    struct demux dm;
+    int inlen = 0, inpos = 0;
+    int in_eof = 0;
+    int idle_exit = 0;
+    int use_splice = 0;
+    int port_writable = 0;
+    int port_flags;
+    int ready, maxfd, outlen;
+    ssize_t r;
+#ifdef __linux__
+    struct stat st;
+#endif
+    struct timeval idle;
+    fd_set rset, wset;
+
+#ifdef __linux__
+    use_splice = fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+    con_start();
+    tx_flush();
+    // the port is normally blocking; here a full port must not hold up
+    // reading from it
+    port_flags = fcntl(hSerial, F_GETFL);
+    if (port_flags != -1) {
+        fcntl(hSerial, F_SETFL, port_flags | O_NONBLOCK);
+    }
+
+    memset(&dm, 0, sizeof(dm));
+    dm.escapes = 1;
+    while (!dm.exited) {
+        con_drain(0);
+        FD_ZERO(&rset);
+        FD_ZERO(&wset);
+        maxfd = hSerial;
+        if (rxhead < rxtail) {
+            /* input left over from earlier; handle that first */
+            FD_SET(hSerial, &rset);
+            ready = 1;
+        } else {
+            FD_SET(hSerial, &rset);
+            if (!in_eof) {
+                if (use_splice ? port_writable : inpos == inlen) {
+                    FD_SET(STDIN_FILENO, &rset);
+                } else {
+                    FD_SET(hSerial, &wset);
+                }
+            }
+            if (con_len > 0) {
+                FD_SET(con_fd, &wset);
+                if (con_fd > maxfd) maxfd = con_fd;
+            }
+            idle.tv_sec = 0;
+            idle.tv_usec = PIPE_IDLE_MS * 1000;
+            ready = select(maxfd + 1, &rset, &wset, NULL, idle_exit ? &idle : NULL);
+            if (ready == 0) {
+                // stdin is finished, and the device has nothing more
+                break;
+            }
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+        }
+
+        /* device to stdout */
+        if (FD_ISSET(hSerial, &rset) && (rxhead < rxtail || rx_fill(0) > 0)) {
+            outlen = 0;
+            rxhead += demux(&dm, (char *)rxbuf + rxhead, rxtail - rxhead, out, &outlen);
+            con_out(out, outlen);
+        }
+
+        /* stdin to device */
+        if (FD_ISSET(hSerial, &wset)) {
+            port_writable = 1;
+        }
+        if (use_splice && FD_ISSET(STDIN_FILENO, &rset)) {
+#ifdef __linux__
+            r = splice(STDIN_FILENO, NULL, hSerial, NULL, PIPE_BUF_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+            r = -1;
+            errno = EINVAL;
+#endif
+            if (r == 0) {
+                in_eof = 1;
+            } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // stdin said it was ready, so the port must be full
+                port_writable = 0;
+            } else if (r < 0 && errno != EINTR) {
+                // the kernel cannot splice to this port; copy instead
+                use_splice = 0;
+            }
+        } else if (FD_ISSET(STDIN_FILENO, &rset)) {
+            r = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+            if (r == 0) {
+                in_eof = 1;
+            } else if (r > 0) {
+                inpos = 0;
+                inlen = r;
+            }
+        }
+        if (inpos < inlen && port_writable) {
+            r = write(hSerial, inbuf + inpos, inlen - inpos);
+            if (r > 0) {
+                inpos += r;
+            } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                port_writable = 0;
+            }
+            if (inpos == inlen) {
+                inpos = inlen = 0;
+            }
+        }
+        if (in_eof && !idle_exit && !ignoreEof) {
+            // let the device finish with what we sent, and stop when
+            // it goes quiet
+            wait_drain();
+            idle_exit = 1;
+        }
+    }
+
+    if (port_flags != -1) {
+        fcntl(hSerial, F_SETFL, port_flags);
+    }
+    con_finish();
+    if (dm.exited) {
+        promptexit(dm.exitcode);
+    }
+}
+
 unsigned long long
 elapsedms(void)
 {
     struct timeval t;
 
-    if (!gettimeofday(&t, NULL)) {
+    if (gettimeofday(&t, NULL) != 0) {
         // how could this fail??
         return time(NULL) * 1000ULL;
     }
@@ -31,10 +31,14 @@
 
 #include <conio.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 #include <io.h>
+#include <fcntl.h>
 #include "osint.h"
 
+extern int ignoreEof; /* in main file */
+
 static HANDLE hSerial = INVALID_HANDLE_VALUE;
 static COMMTIMEOUTS original_timeouts;
 static COMMTIMEOUTS timeouts;
@@ -150,6 +154,18 @@ int serial_baud(unsigned long baud)
     return 1;
 }
 
+/* SetCommState already changes the rate in place */
+int serial_speed(unsigned long baud)
+{
+    FlushFileBuffers(hSerial);
+    return serial_baud(baud);
+}
+
+unsigned long serial_actual_baud(void)
+{
+    return currentBaud;
+}
+
 /**
  * flush (discard) all pending input
  */
@@ -203,6 +219,57 @@ int tx(uint8_t* buff, int n)
     return dwBytes;
 }
 
+/**
+ * get the serial number of the USB adapter behind the open port
+ * (not implemented on Windows)
+ * @returns 1 on success, 0 if there is none
+ */
+int serial_usb_serial(char *buf, int len)
+{
+    return 0;
+}
+
+/**
+ * look up the USB adapter behind a port
+ * (not implemented on Windows)
+ * @returns 1 if the port is on a USB device, 0 if not (or unknown)
+ */
+int serial_port_usb_info(const char *port, int *vid, int *pid, char *serial, int len)
+{
+    return 0;
+}
+
+/**
+ * describe the latency settings made when the port was opened
+ * (the FTDI latency timer is a driver property on Windows, so
+ * nothing is changed here)
+ * @returns a string, or NULL if nothing was changed or checked
+ */
+const char *serial_latency_info(void)
+{
+    return NULL;
+}
+
+/**
+ * number of receive overruns on the port so far
+ * (Windows only reports that one happened, not how many)
+ * @returns 0 on success, -1 if not available
+ */
+int serial_overruns(unsigned long *count)
+{
+    return -1;
+}
+
+/**
+ * send any buffered output
+ * (WriteFile already hands everything to the driver at once)
+ * @returns zero on failure
+ */
+int tx_flush(void)
+{
+    return 1;
+}
+
 /**
  * receive a buffer
  * @param buff - char pointer to buffer
@@ -226,7 +293,7 @@ int rx(uint8_t* buff, int n)
  * @param buff - char pointer to buffer
  * @param n - number of bytes in buffer to read
  * @param timeout - timeout in milliseconds
- * @returns number of bytes read or SERIAL_TIMEOUT
+ * @returns number of bytes read, SERIAL_TIMEOUT or SERIAL_ERROR
  */
 int rx_timeout(uint8_t* buff, int n, int timeout)
 {
@@ -236,11 +303,83 @@ int rx_timeout(uint8_t* buff, int n, int timeout)
     if(!ReadFile(hSerial, buff, n, &dwBytes, NULL)){
         printf("Error reading port\n");
         ShowLastError();
-        return 0;
+        return SERIAL_ERROR;
     }
     return dwBytes > 0 ? dwBytes : SERIAL_TIMEOUT;
 }
 
+/**
+ * receive exactly n bytes, waiting at most timeout ms in all
+ * @param buff - char pointer to buffer
+ * @param n - number of bytes to read
+ * @param timeout - timeout in milliseconds
+ * @returns number of bytes read (less than n on timeout or error)
+ */
+int rx_exact(uint8_t* buff, int n, int timeout)
+{
+    unsigned long long deadline = elapsedms() + timeout;
+    unsigned long long now;
+    int got = 0;
+    int r;
+
+    while (got < n) {
+        now = elapsedms();
+        if (now >= deadline) {
+            break;
+        }
+        r = rx_timeout(buff + got, n - got, (int)(deadline - now));
+        if (r == SERIAL_ERROR) {
+            break;
+        }
+        if (r > 0) {
+            got += r;
+        }
+    }
+    return got;
+}
+
+/**
+ * throw away input up to and including the first occurrence of pat
+ * (the driver buffers input, so reading a byte at a time is OK here)
+ * @param pat - bytes to look for
+ * @param len - length of pat
+ * @param timeout - timeout in milliseconds (forever if < 0)
+ * @returns 1 if pat was seen, 0 on timeout or error
+ */
+int rx_until(const uint8_t* pat, int len, int timeout)
+{
+    unsigned long long deadline = elapsedms() + timeout;
+    unsigned long long now;
+    int match = 0;
+    int k;
+    uint8_t c;
+
+    for(;;) {
+        if (timeout >= 0) {
+            now = elapsedms();
+            if (now >= deadline) {
+                return 0;
+            }
+        }
+        k = rx_timeout(&c, 1, timeout < 0 ? 100 : (int)(deadline - now));
+        if (k == SERIAL_ERROR) {
+            return 0;
+        }
+        if (k != 1) {
+            continue;
+        }
+        while (match > 0 && c != pat[match]) {
+            for (k = match - 1; k > 0; k--) {
+                if (!memcmp(pat, pat + match - k, k)) break;
+            }
+            match = k;
+        }
+        if (c == pat[match] && ++match == len) {
+            return 1;
+        }
+    }
+}
+
 /**
  * hwreset ... resets Propeller hardware using DTR
  * @returns void
@@ -255,6 +394,16 @@ void hwreset(void)
     PurgeComm(hSerial, PURGE_TXABORT | PURGE_RXABORT | PURGE_TXCLEAR | PURGE_RXCLEAR);
 }
 
+/**
+ * hold the transmit line low (a break) for ms milliseconds
+ */
+void serial_break(int ms)
+{
+    SetCommBreak(hSerial);
+    Sleep(ms);
+    ClearCommBreak(hSerial);
+}
+
 static unsigned long getms()
 {
     LARGE_INTEGER ticksPerSecond;
@@ -389,7 +538,7 @@ void terminal_mode(int runterm_mode, int pst_mode)
     setvbuf(stdout, NULL, _IONBF, 1); // stdout should be unbuffered
     while (continue_terminal) {
         uint8_t buf[1];
-        if (rx_timeout(buf, 1, 0) != SERIAL_TIMEOUT) {
+        if (rx_timeout(buf, 1, 0) == 1) {
             if (sawexit_valid) {
                 exitcode = buf[0];
                 continue_terminal = 0;
@@ -437,6 +586,14 @@ done:
     }
 }
 
+/*
+ * -PIPE is not supported on Windows; loadp2 refuses it before
+ * getting this far
+ */
+void pipe_mode(void)
+{
+}
+
 unsigned long long
 elapsedms(void)
 {
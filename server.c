@@ -0,0 +1,640 @@
+/*
+ * @file server.c
+ *
+ * loader server, which keeps serial ports open between loads
+ *
+ * Copyright (c) 2024 Total Spectrum Software Inc.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "osint.h"
+#include "server.h"
+
+#if defined(__MINGW32__) || defined(__MINGW64__)
+
+int server_run(const char *path, int nports, char **ports, unsigned long baud, int *pargc, char ***pargv)
+{
+    printf("-SERVE is not supported on Windows\n");
+    return -1;
+}
+
+int client_run(const char *path, int argc, char **argv)
+{
+    printf("-CLIENT is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAX_PORTS     16
+#define MAX_REQUEST   65536  /* most bytes in a request's directory and arguments */
+#define REQUEST_FDS   3      /* the client's stdin, stdout, stderr */
+
+/* a request waiting for (or being handled by) a port */
+struct request {
+    struct request *next;
+    int conn;                /* connection to the client */
+    int fds[REQUEST_FDS];
+    uint32_t len;
+    char *data;              /* directory, then each argument, NUL terminated */
+};
+
+struct port {
+    const char *name;
+    pid_t worker;
+    int sock;                /* our end of the socketpair to the worker */
+    int busy;
+    struct request *queue;   /* waiting requests, oldest first */
+};
+
+static const char *sock_path;
+
+static int
+open_socket(const char *path, struct sockaddr_un *addr)
+{
+    int s;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        printf("socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) {
+        printf("unable to create socket: %s\n", strerror(errno));
+    }
+    return s;
+}
+
+/* read exactly n bytes; returns 0 on EOF or error */
+static int
+read_full(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        p += r;
+        n -= r;
+    }
+    return 1;
+}
+
+static int
+write_full(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while (n > 0) {
+        r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        p += r;
+        n -= r;
+    }
+    return 1;
+}
+
+/*
+ * send a request: its length and file descriptors in one message,
+ * then its data
+ */
+static int
+send_request(int sock, const int *fds, int nfds, const char *data, uint32_t len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * (REQUEST_FDS+1))];
+    } ctl;
+    struct cmsghdr *cmsg;
+    ssize_t r;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctl, 0, sizeof(ctl));
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    do {
+        r = sendmsg(sock, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r != sizeof(len)) {
+        return 0;
+    }
+    return write_full(sock, data, len);
+}
+
+/*
+ * receive a request sent by send_request, which must carry exactly
+ * nfds file descriptors
+ * returns 1 on success, 0 on failure (the descriptors are closed)
+ */
+static int
+recv_request(int sock, int *fds, int nfds, char **pdata, uint32_t *plen)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * (REQUEST_FDS+1))];
+    } ctl;
+    struct cmsghdr *cmsg;
+    uint32_t len;
+    char *data;
+    int i, got = 0;
+    ssize_t r;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    do {
+        r = recvmsg(sock, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (got > REQUEST_FDS+1) got = REQUEST_FDS+1;
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * got);
+        }
+    }
+    if (r != sizeof(len) || got != nfds || len == 0 || len > MAX_REQUEST) {
+        goto fail;
+    }
+    data = malloc(len + 1);
+    if (!data) {
+        goto fail;
+    }
+    if (!read_full(sock, data, len)) {
+        free(data);
+        goto fail;
+    }
+    data[len] = 0;
+    *pdata = data;
+    *plen = len;
+    return 1;
+fail:
+    for (i = 0; i < got; i++) {
+        close(fds[i]);
+    }
+    return 0;
+}
+
+/* report an error to a client which we cannot hand to a worker */
+static void
+reject_request(struct request *req, const char *msg)
+{
+    uint8_t status = 1;
+
+    write_full(req->fds[2], msg, strlen(msg));
+    write_full(req->conn, &status, 1);
+    close(req->conn);
+    close(req->fds[0]);
+    close(req->fds[1]);
+    close(req->fds[2]);
+    free(req->data);
+    free(req);
+}
+
+/*
+ * find the port a request asks for with -p, or NULL if it does not
+ * say (in which case any port will do)
+ */
+static const char *
+request_port(struct request *req)
+{
+    const char *p = req->data + strlen(req->data) + 1; /* skip directory */
+    const char *end = req->data + req->len;
+
+    while (p < end) {
+        if (!strcmp(p, "-a") || !strcmp(p, "--args")) {
+            break;
+        }
+        if (!strncmp(p, "-p", 2)) {
+            if (p[2]) return p + 2;
+            p += strlen(p) + 1;
+            return p < end ? p : NULL;
+        }
+        p += strlen(p) + 1;
+    }
+    return NULL;
+}
+
+static int
+same_port(const char *a, const char *b)
+{
+    char ra[PATH_MAX], rb[PATH_MAX];
+
+    if (!strcmp(a, b)) return 1;
+    return realpath(a, ra) && realpath(b, rb) && !strcmp(ra, rb);
+}
+
+/* hand the next waiting request to an idle worker */
+static void
+dispatch(struct port *port)
+{
+    struct request *req = port->queue;
+    int fds[REQUEST_FDS+1];
+
+    if (port->busy || !req) {
+        return;
+    }
+    port->queue = req->next;
+    fds[0] = req->conn;
+    memcpy(fds + 1, req->fds, sizeof(req->fds));
+    if (send_request(port->sock, fds, REQUEST_FDS+1, req->data, req->len)) {
+        port->busy = 1;
+        close(req->conn);
+        close(req->fds[0]);
+        close(req->fds[1]);
+        close(req->fds[2]);
+        free(req->data);
+        free(req);
+    } else {
+        reject_request(req, "loadp2 server: port worker is not responding\n");
+    }
+}
+
+/*
+ * turn a request into a command line in the child which handles it
+ */
+static void
+become_request(int conn, int *fds, char *data, uint32_t len, int *pargc, char ***pargv)
+{
+    char **argv;
+    int argc = 0, max = 8;
+    char *p = data + strlen(data) + 1;
+    char *end = data + len;
+
+    argv = malloc((max + 2) * sizeof(*argv));
+    if (!argv) _exit(1);
+    argv[argc++] = "loadp2";
+    while (p < end) {
+        if (argc == max) {
+            max *= 2;
+            argv = realloc(argv, (max + 2) * sizeof(*argv));
+            if (!argv) _exit(1);
+        }
+        argv[argc++] = p;
+        p += strlen(p) + 1;
+    }
+    argv[argc] = NULL;
+    argv[argc+1] = NULL; // in case -a makes main look one past the end
+
+    fflush(stdout);
+    dup2(fds[0], 0);
+    dup2(fds[1], 1);
+    dup2(fds[2], 2);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    close(conn);
+    setvbuf(stdout, NULL, isatty(1) ? _IOLBF : _IOFBF, BUFSIZ);
+    if (chdir(data) != 0) {
+        printf("loadp2 server: cannot change to directory %s\n", data);
+    }
+    signal(SIGPIPE, SIG_DFL);
+    *pargc = argc;
+    *pargv = argv;
+}
+
+/*
+ * a worker holds one port open and runs requests on it one at a time;
+ * it only returns in the child which runs a request
+ */
+static int
+run_worker(int sock, const char *name, unsigned long baud, int *pargc, char ***pargv)
+{
+    int fds[REQUEST_FDS+1];
+    char *data;
+    uint32_t len;
+    pid_t pid;
+    int status, done;
+    uint8_t result;
+    struct pollfd pfd;
+
+    if (!serial_init(name, baud)) {
+        printf("loadp2 server: unable to open %s\n", name);
+        _exit(1);
+    }
+    for(;;) {
+        if (!recv_request(sock, fds, REQUEST_FDS+1, &data, &len)) {
+            // the server has gone away
+            serial_done();
+            _exit(0);
+        }
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            close(sock);
+            become_request(fds[0], fds + 1, data, len, pargc, pargv);
+            return 0;
+        }
+        free(data);
+        close(fds[1]);
+        close(fds[2]);
+        close(fds[3]);
+        result = 1;
+        if (pid > 0) {
+            // wait for the child, stopping it if the client goes away
+            pfd.fd = fds[0];
+            pfd.events = POLLIN;
+            for (done = 0; !done; ) {
+                if (waitpid(pid, &status, WNOHANG) == pid) {
+                    result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+                    break;
+                }
+                if (poll(&pfd, 1, 100) > 0) {
+                    kill(pid, SIGINT);
+                    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+                        ;
+                    done = 1;
+                }
+            }
+        }
+        write_full(fds[0], &result, 1);
+        close(fds[0]);
+        // tell the server we are ready for more
+        result = 0;
+        write_full(sock, &result, 1);
+    }
+}
+
+static void
+stop_server(int signum)
+{
+    if (sock_path) unlink(sock_path);
+    _exit(1);
+}
+
+int
+server_run(const char *path, int nports, char **ports, unsigned long baud, int *pargc, char ***pargv)
+{
+    struct sockaddr_un addr;
+    struct port port[MAX_PORTS];
+    struct pollfd pfd[MAX_PORTS+1];
+    struct request *req, **tail;
+    const char *want;
+    int lsock, sv[2];
+    int i, j, r, alive;
+    mode_t old_mask;
+    uint8_t c;
+
+    if (nports > MAX_PORTS) {
+        printf("loadp2 server: at most %d ports may be served\n", MAX_PORTS);
+        return -1;
+    }
+    lsock = open_socket(path, &addr);
+    if (lsock < 0) {
+        return -1;
+    }
+    if (connect(lsock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        printf("loadp2 server: a server is already running on %s\n", path);
+        close(lsock);
+        return -1;
+    }
+    close(lsock);
+    unlink(path);
+    lsock = open_socket(path, &addr);
+    if (lsock < 0) {
+        return -1;
+    }
+    // the socket gives control of the boards; keep it to ourselves
+    // from the moment it appears
+    old_mask = umask(077);
+    r = bind(lsock, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (r != 0 || listen(lsock, 16) != 0) {
+        printf("loadp2 server: unable to listen on %s: %s\n", path, strerror(errno));
+        close(lsock);
+        return -1;
+    }
+    sock_path = path;
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < nports; i++) {
+        port[i].name = ports[i];
+        port[i].busy = 0;
+        port[i].queue = NULL;
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            printf("loadp2 server: socketpair failed: %s\n", strerror(errno));
+            return -1;
+        }
+        fflush(stdout);
+        port[i].worker = fork();
+        if (port[i].worker == 0) {
+            close(lsock);
+            close(sv[0]);
+            for (j = 0; j < i; j++) {
+                close(port[j].sock);
+            }
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            sock_path = NULL;
+            run_worker(sv[1], ports[i], baud, pargc, pargv);
+            return i;
+        }
+        close(sv[1]);
+        port[i].sock = sv[0];
+        printf("Serving %s on %s\n", ports[i], path);
+    }
+    fflush(stdout);
+
+    for(;;) {
+        alive = 0;
+        pfd[0].fd = lsock;
+        pfd[0].events = POLLIN;
+        for (i = 0; i < nports; i++) {
+            pfd[i+1].fd = port[i].sock;
+            pfd[i+1].events = POLLIN;
+            if (port[i].sock >= 0) alive++;
+        }
+        if (!alive) {
+            printf("loadp2 server: no ports left to serve\n");
+            unlink(path);
+            exit(1);
+        }
+        if (poll(pfd, nports+1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < nports; i++) {
+            if (port[i].sock < 0 || !pfd[i+1].revents) continue;
+            if (read(port[i].sock, &c, 1) == 1) {
+                port[i].busy = 0;
+            } else {
+                // the worker died (e.g. the port could not be opened)
+                printf("loadp2 server: stopped serving %s\n", port[i].name);
+                close(port[i].sock);
+                port[i].sock = -1;
+                while ((req = port[i].queue) != NULL) {
+                    port[i].queue = req->next;
+                    reject_request(req, "loadp2 server: port is no longer served\n");
+                }
+                waitpid(port[i].worker, NULL, 0);
+            }
+            dispatch(&port[i]);
+        }
+        if (!(pfd[0].revents & POLLIN)) continue;
+
+        req = calloc(1, sizeof(*req));
+        if (!req) continue;
+        req->conn = accept(lsock, NULL, NULL);
+        if (req->conn < 0) {
+            free(req);
+            continue;
+        }
+        if (!recv_request(req->conn, req->fds, REQUEST_FDS, &req->data, &req->len)) {
+            close(req->conn);
+            free(req);
+            continue;
+        }
+        // pick the port asked for, or else the idle one with the
+        // shortest queue
+        want = request_port(req);
+        j = -1;
+        for (i = 0; i < nports; i++) {
+            if (port[i].sock < 0) continue;
+            if (want) {
+                if (same_port(want, port[i].name)) {
+                    j = i;
+                    break;
+                }
+            } else if (j < 0 || (port[j].busy && !port[i].busy)) {
+                j = i;
+            }
+        }
+        if (j < 0) {
+            reject_request(req, want ? "loadp2 server: that port is not served here\n"
+                                     : "loadp2 server: no ports left to serve\n");
+            continue;
+        }
+        for (tail = &port[j].queue; *tail; tail = &(*tail)->next)
+            ;
+        *tail = req;
+        dispatch(&port[j]);
+    }
+    unlink(path);
+    return -1;
+}
+
+int
+client_run(const char *path, int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    char cwd[PATH_MAX];
+    char *data, *p;
+    size_t len;
+    int fds[REQUEST_FDS] = { 0, 1, 2 };
+    int s, i;
+    uint8_t status;
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        printf("unable to get current directory\n");
+        return 1;
+    }
+    len = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    if (len > MAX_REQUEST) {
+        printf("command line is too long\n");
+        return 1;
+    }
+    data = malloc(len);
+    if (!data) {
+        printf("out of memory\n");
+        return 1;
+    }
+    p = data;
+    strcpy(p, cwd);
+    p += strlen(p) + 1;
+    for (i = 0; i < argc; i++) {
+        strcpy(p, argv[i]);
+        p += strlen(p) + 1;
+    }
+
+    s = open_socket(path, &addr);
+    if (s < 0) {
+        free(data);
+        return 1;
+    }
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("unable to connect to loadp2 server at %s: %s\n", path, strerror(errno));
+        free(data);
+        close(s);
+        return 1;
+    }
+    fflush(stdout);
+    if (!send_request(s, fds, REQUEST_FDS, data, (uint32_t)len)) {
+        printf("unable to send request to loadp2 server\n");
+        free(data);
+        close(s);
+        return 1;
+    }
+    free(data);
+    // the server talks to our terminal directly; just wait to hear
+    // how it went
+    if (!read_full(s, &status, 1)) {
+        printf("loadp2 server went away\n");
+        status = 1;
+    }
+    close(s);
+    return status;
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * @file server.h
+ *
+ * loader server, which keeps serial ports open between loads
+ *
+ * Copyright (c) 2024 Total Spectrum Software Inc.
+ *
+ * MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef SERVER_H__
+#define SERVER_H__
+
+/*
+ * A loader server (loadp2 -SERVE socket) opens its serial ports once
+ * and keeps them open. Each port has a worker process which holds it.
+ * A client (loadp2 -CLIENT socket ...) sends its working directory,
+ * its command line and its stdin/stdout/stderr over the Unix socket.
+ * The worker forks a child which runs that command line on the open
+ * port, talking to the client's terminal directly. When the child
+ * exits, its exit status is sent back to the client as a single byte.
+ */
+
+/*
+ * serve requests on the Unix socket at path for the given ports
+ * (opened at the given baud rate)
+ * This only returns in a child process which should handle one
+ * request: *pargc and *pargv are set to its command line, and the
+ * return value is the index of the port, which is open already.
+ * If the server cannot be started it returns -1.
+ */
+int server_run(const char *path, int nports, char **ports, unsigned long baud, int *pargc, char ***pargv);
+
+/*
+ * send a command line to the server at path and wait for it to finish
+ * returns the exit status of the request
+ */
+int client_run(const char *path, int argc, char **argv);
+
+#endif
@@ -329,6 +329,13 @@ isowner(User *u, Fid *f)
 
 
 
+// the biggest message u9fs_process can be given
+int
+u9fs_max_message(void)
+{
+	return msize;
+}
+
 // handle one u9fs transaction
 // "nbuf" is number of characters already read from the serial,
 // which we will have to fetch before readn